@@ -9,4 +9,11 @@
 #define AT168_COMPATIBLE
 #endif
 
+/* Timer1 flags and interrupt mask, in TIFR and TIMSK on the ATmega8 */
+#ifdef AT168_COMPATIBLE
+#define TIFR	TIFR1
+#define TIMSK	TIMSK1
+#define TICIE1	ICIE1
+#endif
+
 #endif // _atmega168_compat_h__
@@ -1,7 +1,70 @@
+#ifndef _boarddef_h__
+#define _boarddef_h__
+
+/* Board variant where the gamecube data line is on ICP1 / PB0 instead
+ * of PC5. Replies are then received by timestamping their rising edges
+ * with the Timer1 input capture unit, from an interrupt which stores
+ * them for decoding once the reply is over. A short interrupt during
+ * the reply (the latch with NES_SERVE_SPI) does not lose it. Timer1
+ * runs at /8 instead of /64 (sync.h).
+ */
+//#define GC_RX_ICP
+
 /******** IO port definitions **************/
+#ifdef GC_RX_ICP
+#define GC_DATA_PORT	PORTB
+#define GC_DATA_DDR	DDRB
+#define GC_DATA_PIN	PINB
+#define GC_DATA_BIT_NUM	0
+#else
 #define GC_DATA_PORT	PORTC
 #define GC_DATA_DDR	DDRC
 #define GC_DATA_PIN	PINC
-#define GC_DATA_BIT	(1<<5)
+#define GC_DATA_BIT_NUM	5
+#endif
+#define GC_DATA_BIT	(1<<GC_DATA_BIT_NUM)
+
+/* Board variant (ATmega88/168/328 only) where the gamecube commands are
+ * sent by the USART in master SPI mode, each protocol bit being encoded
+ * as 4 symbols of 1us. TXD0 / PD1 drives the gamecube data line through
+ * an open-drain buffer (the line is pulled up to 3.3 volt). GC_DATA_*
+ * above is then only used to read the line. XCK0 / PD4 is an output and
+ * must be left unconnected.
+ *
+ * The USART holds 8 to 16us of the command. Without NES_SERVE_SPI, the
+ * latch interrupt lasts for the whole NES read (over 100us), so any
+ * latch during a command breaks it and the command is sent again.
+ */
+//#define GC_TX_USART
+
+/* Board variant with the NES lines wired to the SPI peripheral, which
+ * then shifts the data out in slave mode. The CPU only reloads SPDR
+ * on latch (and after each byte in raw mode) instead of polling the
+ * clock line for the whole read.
+ *
+ * INT0 / PD2 + SS / PB2 : NES Latch
+ * SCK / PB5             : NES Clock
+ * MISO / PB4            : NES Data
+ * MOSI / PB3            : Ground
+ *
+ * PB4/PB5 are then no longer available as debug outputs.
+ */
+//#define NES_SERVE_SPI
 
+#ifdef NES_SERVE_SPI
+#define NES_DATA_PORT 	PORTB
+#define NES_DATA_DDR	DDRB
+#define NES_DATA_BIT	4
+#define NES_CLOCK_BIT	5
+#define NES_CLOCK_PIN	PINB
+#else
+#define NES_DATA_PORT 	PORTC
+#define NES_DATA_DDR	DDRC
+#define NES_DATA_BIT	0
+#define NES_CLOCK_BIT	1
+#define NES_CLOCK_PIN	PINC
+#endif
+#define NES_LATCH_PIN	PIND
+#define NES_LATCH_BIT	2
 
+#endif // _boarddef_h__
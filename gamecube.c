@@ -19,9 +19,7 @@
 	You should have received a copy of the GNU General Public License
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
+#include "hal.h"
 #include <string.h>
 #include "gamepad.h"
 #include "gamecube.h"
@@ -42,6 +40,28 @@ static unsigned char last_sent_report[GCN64_REPORT_SIZE];
 static int gc_rumbling = 0;
 static int gc_analog_lr_disable = 0;
 
+/* The controller identity (GC_GETID) is read when the controller state
+ * is unknown (at init or after a failed status read, unless it failed
+ * because it was interrupted) and then only every
+ * GC_ID_KEEPALIVE polls, so a normal poll is a single GC_GETSTATUS. */
+#define GC_STATE_UNKNOWN	0
+#define GC_STATE_READY		1
+
+/* Counted in polls (a retried transaction counts once), not in time:
+ * about 2 seconds with one poll per 60Hz frame, but much less while
+ * polling continuously (before the frame period is locked, in the gaps
+ * of games which latch without end, in tap capture mode). */
+#define GC_ID_KEEPALIVE		128
+
+static unsigned char gc_state = GC_STATE_UNKNOWN;
+static unsigned char gc_polls_since_id;
+static unsigned char gc_id[3];
+
+char gamecubeNeedsId(void)
+{
+	return gc_state != GC_STATE_READY || gc_polls_since_id >= GC_ID_KEEPALIVE;
+}
+
 static void gamecubeInit(void)
 {
 	if (0 == gamecubeUpdate()) {
@@ -66,25 +86,33 @@ static char gamecubeUpdate(void)
 	unsigned char count;
 	unsigned char x,y,cx,cy,rtrig,ltrig,btns1,btns2,rb1,rb2;
 
-#if 1
-	/* Get ID command.
-	 *
-	 * If we don't do that, the wavebird does not work.
-	 *
-	 * 2015-12-08: RA:
-	 * 	In fact, calling gcn64_detectController at least
-	 * 	once is enough to "enable" the wavebird receiver. In any case,
-	 * 	the GET_STATUS commands below get answered. This means
-	 * 	this GET_ID command is in fact optional. Removing it
-	 * 	does not seem to do harm with my receiver at least. But
-	 * 	I will not risk changing what has been there for years.
-	 */
-	tmp = GC_GETID;
-	count = gcn64_transaction(&tmp, 1);
-	if (count != GC_GETID_REPLY_LENGTH) {
-		return 1;
+	if (gamecubeNeedsId()) {
+		/* Get ID command.
+		 *
+		 * If we don't do that, the wavebird does not work.
+		 *
+		 * 2015-12-08: RA:
+		 * 	In fact, calling gcn64_detectController at least
+		 * 	once is enough to "enable" the wavebird receiver. In any case,
+		 * 	the GET_STATUS commands below get answered. This means
+		 * 	this GET_ID command is in fact optional. Removing it
+		 * 	does not seem to do harm with my receiver at least.
+		 *
+		 * 	It is therefore no longer sent on every poll, only until
+		 * 	it succeeds, after a failure and as a keep-alive.
+		 */
+		tmp = GC_GETID;
+		count = gcn64_transaction(&tmp, 1);
+		if (count != GC_GETID_REPLY_LENGTH) {
+			if (!gcn64_wasPreempted())
+				gc_state = GC_STATE_UNKNOWN;
+			return 1;
+		}
+		gcn64_protocol_getBytes(0, sizeof(gc_id), gc_id);
+		gc_polls_since_id = 0;
+		gc_state = GC_STATE_READY;
 	}
-#endif
+	gc_polls_since_id++;
 
 	tmpdata[0] = GC_GETSTATUS1;
 	tmpdata[1] = GC_GETSTATUS2;
@@ -92,6 +120,10 @@ static char gamecubeUpdate(void)
 
 	count = gcn64_transaction(tmpdata, 3);
 	if (count != GC_GETSTATUS_REPLY_LENGTH) {
+		/* An interrupted transaction says nothing about the
+		 * controller. */
+		if (!gcn64_wasPreempted())
+			gc_state = GC_STATE_UNKNOWN;
 		return 1; // failure
 	}
 
@@ -192,6 +224,19 @@ static Gamepad GamecubeGamepad = {
 	.setVibration			= gamecubeVibration,
 };
 
+unsigned char gamecubeGetKind(void)
+{
+	if (gc_state != GC_STATE_READY)
+		return GC_KIND_UNKNOWN;
+
+	/* The most significant bit of the identity is set for wireless
+	 * controllers (Wavebird receivers, etc) */
+	if (gc_id[0] & 0x80)
+		return GC_KIND_WIRELESS;
+
+	return GC_KIND_WIRED;
+}
+
 Gamepad *gamecubeGetGamepad(void)
 {
 	return &GamecubeGamepad;
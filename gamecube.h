@@ -4,6 +4,18 @@
 
 Gamepad *gamecubeGetGamepad(void);
 
+/* What kind of controller answered the last GC_GETID. Reply times
+ * differ between kinds. */
+#define GC_KIND_UNKNOWN		0
+#define GC_KIND_WIRED		1
+#define GC_KIND_WIRELESS	2
+#define GC_KINDS			3
+
+unsigned char gamecubeGetKind(void);
+
+/* Non-zero if the next update starts with a GC_GETID. */
+char gamecubeNeedsId(void);
+
 #define GC_GET_START(report) (report[6] & 0x01)
 #define GC_GET_Y(report) (report[6] & 0x02)
 #define GC_GET_X(report) (report[6] & 0x04)
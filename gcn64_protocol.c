@@ -14,10 +14,13 @@
 	You should have received a copy of the GNU General Public License
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include <avr/io.h>
-#include <util/delay.h>
+#include "hal.h"
+#include <string.h>
 
 #include "gcn64_protocol.h"
+#include "boarddef.h"
+#include "atmega168compat.h"
+#include "sync.h"
 
 #undef FORCE_KEYBOARD
 #undef FORCE_GAMECUBE
@@ -32,15 +35,50 @@
 // the project and are willing to change this.
 #undef GAMECUBE_TIMINGS // If not defined, use N64 timings
 
-#define GCN64_BUF_SIZE	300
+/* Longest command sent and longest reply accepted by this firmware
+ * (GC_GETSTATUS and its 64 bit answer). */
+#define GCN64_MAX_TX_BYTES	3
+#define GCN64_MAX_RX_BITS	GC_GETSTATUS_REPLY_LENGTH
+
+/* One byte per bit for the transmit code. */
+#define GCN64_BUF_SIZE	(GCN64_MAX_TX_BYTES * 8)
 static volatile unsigned char gcn64_workbuf[GCN64_BUF_SIZE];
 
-/******** IO port definitions **************/
-#define GCN64_DATA_PORT	PORTC
-#define GCN64_DATA_DDR	DDRC
-#define GCN64_DATA_PIN	PINC
-#define GCN64_DATA_BIT	(1<<5)
+/* The last received frame, 8 bits per byte, MSb first. */
+static unsigned char gcn64_rxbuf[GCN64_MAX_RX_BITS / 8];
+
+/* IO port definitions are in boarddef.h (GC_DATA_*) */
+
+/* A preempted transaction is tried at most this many times more. */
+#define GCN64_MAX_RETRIES	2
+
+volatile unsigned char gcn64_irq_count;
+static char (*gcn64_retry_hook)(void);
+static struct gcn64_stats gcn64_stats;
+static char gcn64_preempted;
+
+#ifdef GC_TX_USART
+#ifndef AT168_COMPATIBLE
+#error GC_TX_USART requires a USART supporting master SPI mode (ATmega88/168/328)
+#endif
+#ifdef GAMECUBE_TIMINGS
+#error GC_TX_USART only implements N64 timings
+#endif
+
+/* One USART symbol lasts 1us. UBRR is computed for the master SPI mode
+ * where the bit rate is F_CPU / (2 * (UBRR + 1)). */
+#define GC_TX_UBRR		((F_CPU / 2000000L) - 1)
 
+/* Each protocol bit is 4 symbols. 0: 3us low, 1us high. 1: 1us low,
+ * 3us high. Two protocol bits per USART byte. */
+#define GC_TX_SYM_0		0x1
+#define GC_TX_SYM_1		0x7
+
+/* The stop bit (1us low) followed by a released line. */
+#define GC_TX_STOP		0x7f
+#endif
+
+#if !defined(GC_TX_USART) && !defined(HOST_BUILD)
 /*
  * \brief Explode bytes to bits
  * \param bytes 	The input byte array
@@ -56,7 +94,7 @@ static int bitsToWorkbufBytes(unsigned char *bytes, int num_bytes, int workbuf_b
 	int i, bit;
 	unsigned char p;
 
-	if (num_bytes * 8 > GCN64_BUF_SIZE)
+	if (num_bytes > GCN64_MAX_TX_BYTES)
 		return 0;
 
 	for (i=0,bit=0; i<num_bytes; i++) {
@@ -68,31 +106,37 @@ static int bitsToWorkbufBytes(unsigned char *bytes, int num_bytes, int workbuf_b
 
 	return bit;
 }
+#endif
 
-/* Read a byte from the buffer (where 1 byte is 1 bit).
+/* Read a byte from the received frame. The offset is in bits,
  * MSb first.
  */
 unsigned char gcn64_protocol_getByte(int offset)
 {
-	unsigned char val, b;
-	unsigned char volatile *addr = gcn64_workbuf + offset;
-
-	for (b=0x80, val=0; b; b>>=1)
-	{
-		if (*addr)
-			val |= b;
-		addr++;
-	}
-	return val;
+	unsigned char idx = offset >> 3;
+	unsigned char shift = offset & 7;
+
+	if (!shift)
+		return gcn64_rxbuf[idx];
+
+	// Not used by this firmware. Kept for compatibility.
+	if (idx + 1 >= sizeof(gcn64_rxbuf))
+		return gcn64_rxbuf[idx] << shift;
+
+	return (gcn64_rxbuf[idx] << shift) | (gcn64_rxbuf[idx+1] >> (8 - shift));
 }
 
 void gcn64_protocol_getBytes(int offset, int n_bytes, unsigned char *dstbuf)
 {
-	int i;
+	if (!(offset & 7)) {
+		memcpy(dstbuf, gcn64_rxbuf + (offset >> 3), n_bytes);
+		return;
+	}
 
-	for (i=0; i<n_bytes; i++) {
-		*dstbuf = gcn64_protocol_getByte(offset + (i*8));
+	while (n_bytes--) {
+		*dstbuf = gcn64_protocol_getByte(offset);
 		dstbuf++;
+		offset += 8;
 	}
 }
 
@@ -102,12 +146,273 @@ void gcn64_protocol_getBytes(int offset, int n_bytes, unsigned char *dstbuf)
 // "hangs in there" much longer than necessary..
 #define TIMING_OFFSET	100 // gives about 12uS. Twice the expected maximum bit period.
 
+/* \brief Receive and decode a reply
+ * \return The number of bits received, 0 on timeout/error.
+ *
+ * Each bit is classified as soon as its high level ends (i.e. on the
+ * falling edge starting the next bit or the stop bit) and shifted
+ * into a byte holding a sentinel bit. When the sentinel falls out
+ * through the carry, the byte is complete and stored in gcn64_rxbuf.
+ *
+ *          ________
+ * ________/
+ *
+ *   [low]    [high]
+ *
+ *          ________________
+ * 0 : ____/
+ *                      ____
+ * 1 : ________________/
+ *
+ * The timings on a real N64 are
+ *
+ * 0 : 1 us low, 3 us high
+ * 1 : 3 us low, 1 us high
+ *
+ * However, HORI pads use something similar to
+ *
+ * 0 : 1.5 us low, 4.5 us high
+ * 1 : 4.5 us low, 1.5 us high
+ *
+ * so bits are not classified against a fixed threshold, but by comparing
+ * the low and high lengths of the same bit (low < high).
+ *
+ * The stop bit is a short (~1us) low state followed by an "infinite"
+ * high state, which timeouts and lets the function return. A timeout
+ * while the line is low is an error.
+ */
+#if defined(HOST_BUILD)
+/* C version for host builds, for the reply given by host/hostbus.c. The
+ * levels are measured in iterations of the waiting loops above (5 cycles)
+ * with the same timeouts. */
+#define HOST_LOOP_US		(5.0 * 1000000.0 / F_CPU)
+#define HOST_TIMEOUT_US		((127 - TIMING_OFFSET) * HOST_LOOP_US)
+
+static unsigned char gcn64_receive()
+{
+	struct host_bit bits[GCN64_MAX_RX_BITS + 2];
+	unsigned char count=0;
+	unsigned char partial = 0x01;
+	int i, n;
+
+	n = host_gcn64_reply(bits, GCN64_MAX_RX_BITS + 2);
+	if (n == 0)
+		return 0; // initial_wait_low timeout
+
+	for (i=0; ; i++) {
+		if (i >= n || bits[i].low_us > HOST_TIMEOUT_US)
+			return 0;
+		if (bits[i].high_us > HOST_TIMEOUT_US)
+			break; // stop bit
+
+		partial = (partial << 1) | (bits[i].low_us < bits[i].high_us);
+		count++;
+		if (count & 7)
+			continue;
+		if (count > GCN64_MAX_RX_BITS)
+			return 0;
+		gcn64_rxbuf[(count >> 3) - 1] = partial;
+		partial = 0x01;
+	}
+
+#elif defined(GC_RX_ICP)
+/* With GC_RX_ICP, the input capture unit timestamps the rising edges of
+ * the reply and TIMER1_CAPT_vect stores them as they come. The reply is
+ * decoded once it is over. The receive code itself only waits, and the
+ * capture interrupt may be held back by another interrupt (a latch, for
+ * instance) until the next rising edge, that is for 2us at least and
+ * most of the time 4us, without losing anything.
+ *
+ * Only one edge can be timed at a time and the falling edge of a 1 is
+ * too close to its rising edge for an interrupt, so only the rising
+ * edges are captured. A bit always lasts the same time T, so the time
+ * between two rising edges is T plus the difference between the low
+ * levels of the two bits:
+ *
+ *   T - T/2 : a 0 followed by a 1 (the low level got shorter)
+ *   T       : the same value twice
+ *   T + T/2 : a 1 followed by a 0
+ *
+ * The level of the first bit is measured from the first falling edge,
+ * which is captured before switching to rising edges. T is found from
+ * the whole reply, so the longer bits of some pads (see above) work
+ * too. A missed edge makes the sequence inconsistent or changes the
+ * number of bits.
+ *
+ * ICR1 is read by the interrupt, which uses the temporary register of
+ * the 16 bit Timer1 registers. Nothing else must access them until the
+ * reception is over.
+ */
+
+/* One rising edge per bit and one for the stop bit. Only the low byte
+ * of ICR1 is kept: edges are much closer than 256 ticks. */
+#define ICP_MAX_EDGES	(GCN64_MAX_RX_BITS + 2)
+static volatile unsigned char gcn64_icp_edges[ICP_MAX_EDGES];
+static volatile unsigned char * volatile gcn64_icp_ptr;
+
+/* The reply is over when no edge came for this long */
+#define ICP_IDLE_US		20
+#define ICP_MAX_US		1000
+
+/* Accepted bit period, in 1/4 tick */
+#define ICP_MIN_PERIOD4	US_TO_TICKS(4 * 3)
+#define ICP_MAX_PERIOD4	US_TO_TICKS(4 * 8)
+
+/* Does not change SREG. The edge is read first, before the next one
+ * replaces it. */
+ISR(TIMER1_CAPT_vect, ISR_NAKED)
+{
+	asm volatile(
+		"	push r16				\n"
+		"	lds r16, %0				\n"
+		"	push r17				\n"
+		"	push r30				\n"
+		"	push r31				\n"
+		"	lds r30, %1				\n"
+		"	lds r31, %1+1			\n"
+		"	ldi r17, lo8(%2)		\n"
+		"	cpse r30, r17			\n" // skip if the buffer is full
+		"	rjmp 1f					\n"
+		"	rjmp 2f					\n"
+		"1:	st z+, r16				\n"
+		"	sts %1, r30				\n"
+		"	sts %1+1, r31			\n"
+		"2:	pop r31					\n"
+		"	pop r30					\n"
+		"	pop r17					\n"
+		"	pop r16					\n"
+		"	reti					\n"
+		:
+		:	"n" (_SFR_MEM_ADDR(ICR1L)),					// %0
+			"i" (&gcn64_icp_ptr),						// %1
+			"i" (gcn64_icp_edges + ICP_MAX_EDGES)		// %2
+	);
+}
+
+static unsigned char gcn64_icpEdges(void)
+{
+	unsigned char sreg = SREG;
+	unsigned char n;
+
+	cli();
+	n = gcn64_icp_ptr - gcn64_icp_edges;
+	SREG = sreg;
+
+	return n;
+}
+
+static unsigned char gcn64_receive()
+{
+	unsigned char count=0;
+	unsigned char partial = 0x01;
+	unsigned char first_fall = 0, found = 0;
+	unsigned char tccr_rise = TCCR1B | (1<<ICES1);
+	unsigned char n, last, bit, i;
+	unsigned char d;
+	unsigned int idle, guard, total, period4, d16;
+
+	gcn64_icp_ptr = gcn64_icp_edges;
+	TCCR1B &= ~(1<<ICES1);
+	TIFR = (1<<ICF1);
+
+	// The data line has been released. Wait for the first falling
+	// edge. The first bit lasts 1us at least: there is time to take
+	// its time from ICR1 and switch to rising edges before it ends.
+	asm volatile(
+		"	clr r16					\n"
+"1:							\n"
+		"	inc r16					\n"
+		"	breq 2f					\n" // overflow to 0
+		"	sbic %2, %3				\n"
+		"	rjmp 1b					\n"
+		"	lds %0, %4				\n"
+		"	sts %5, %6				\n"
+		"	out %7, %8				\n" // changing the edge may set ICF1
+		"	ldi %1, 1				\n"
+"2:							\n"
+		:	"=&r" (first_fall),						// %0
+			"+d" (found)							// %1
+		:	"I" (_SFR_IO_ADDR(GC_DATA_PIN)),		// %2
+			"I" (GC_DATA_BIT_NUM),					// %3
+			"n" (_SFR_MEM_ADDR(ICR1L)),				// %4
+			"n" (_SFR_MEM_ADDR(TCCR1B)),			// %5
+			"r" (tccr_rise),						// %6
+			"I" (_SFR_IO_ADDR(TIFR)),				// %7
+			"r" ((unsigned char)(1<<ICF1))			// %8
+		:	"r16"
+	);
+	if (!found)
+		return 0;
+
+	TIMSK |= (1<<TICIE1);
+	for (idle=0, guard=0, last=0; idle < ICP_IDLE_US && guard < ICP_MAX_US; guard++) {
+		n = gcn64_icpEdges();
+		if (n != last) {
+			last = n;
+			idle = 0;
+		} else {
+			idle++;
+		}
+		_delay_us(1);
+	}
+	TIMSK &= ~(1<<TICIE1);
+
+	n = gcn64_icpEdges();
+	if (n < 2 || guard >= ICP_MAX_US)
+		return 0;
+
+	// From the first falling edge to the stop bit: n - 1 bits
+	total = (unsigned char)(gcn64_icp_edges[0] - first_fall);
+	for (i=1; i<n; i++) {
+		total += (unsigned char)(gcn64_icp_edges[i] - gcn64_icp_edges[i-1]);
+	}
+	period4 = (total * 4) / (n - 1);
+	if (period4 < ICP_MIN_PERIOD4 || period4 > ICP_MAX_PERIOD4)
+		return 0;
+
+	// low < T/2
+	d = gcn64_icp_edges[0] - first_fall;
+	bit = (unsigned int)d * 8 < period4;
+
+	for (i=0; i<n - 1; i++) {
+		if (i) {
+			// compared with T/4, 3T/4, 5T/4 and 7T/4
+			d = gcn64_icp_edges[i] - gcn64_icp_edges[i-1];
+			d16 = (unsigned int)d * 16;
+
+			if (d16 < period4) {
+				return 0;
+			} else if (d16 < 3 * period4) {
+				if (bit)
+					return 0;
+				bit = 1;
+			} else if (d16 > 7 * period4) {
+				return 0;
+			} else if (d16 > 5 * period4) {
+				if (!bit)
+					return 0;
+				bit = 0;
+			}
+		}
+
+		partial = (partial << 1) | bit;
+		count++;
+		if (count & 7)
+			continue;
+		if (count > GCN64_MAX_RX_BITS)
+			return 0;
+		gcn64_rxbuf[(count >> 3) - 1] = partial;
+		partial = 0x01;
+	}
+
+#else
 static unsigned char gcn64_receive()
 {
 	register unsigned char count=0;
+	register unsigned char partial;
 
-#define SET_DBG	"	sbi %3, 4		\n"
-#define CLR_DBG	"	cbi %3, 4		\n"
+#define SET_DBG	"	sbi %4, 4		\n"
+#define CLR_DBG	"	cbi %4, 4		\n"
 
 	// The data line has been released. 
 	// The receive part below expects it to be still high
@@ -118,75 +423,167 @@ static unsigned char gcn64_receive()
 		"	push r31				\n"	// save Z
 		
 		"	clr %0					\n"
+		"	ldi %1, 0x01			\n" // sentinel
 		"	clr r16					\n"
 "initial_wait_low:\n"
 		"	inc r16					\n"
-		"	breq timeout			\n" // overflow to 0
-		"	sbic %2, 5				\n"
+		"	breq error				\n" // overflow to 0
+		"	sbic %3, %7				\n"
 		"	rjmp initial_wait_low	\n"
 
 		// the next transition is to a high bit	
 		"	rjmp waithigh			\n"
 
 "waitlow:\n"
-		"	ldi r16, %4				\n"
+		"	ldi r17, %5				\n"
 "waitlow_lp:\n"
-		"	inc r16					\n"
-		"	brmi timeout			\n" // > 127 (approx 50uS timeout)
-		"	sbic %2, 5				\n"
+		"	inc r17					\n"
+		"	brmi done				\n" // > 127 (approx 50uS timeout)
+		"	sbic %3, %7				\n"
 		"	rjmp waitlow_lp			\n"
 	
-		"	inc %0					\n" // count this timed low level
-		"	breq overflow			\n" // > 255
-		"	st z+,r16				\n"
+		// r16: low length, r17: high length
+		"	cp r16, r17				\n" // carry set if low < high
+		"	rol %1					\n"
+		"	inc %0					\n" // count this bit
+		"	brcc waithigh			\n" // sentinel still in the byte
+		"	cpi %0, %6				\n"
+		"	brsh error				\n" // > GCN64_MAX_RX_BITS
+		"	st z+,%1				\n"
+		"	ldi %1, 0x01			\n"
 
 "waithigh:\n"
-		"	ldi r16, %4				\n"
+		"	ldi r16, %5				\n"
 "waithigh_lp:\n"
 		"	inc r16					\n"
-		"	brmi timeout			\n" // > 127
-		"	sbis %2, 5				\n"
+		"	brmi error				\n" // > 127
+		"	sbis %3, %7				\n"
 		"	rjmp waithigh_lp		\n"
-	
-		"	inc %0					\n" // count this timed high level
-		"	breq overflow			\n" // > 255
-		"	st z+,r16				\n"
-
 		"	rjmp waitlow			\n"
 
-"overflow:  \n"
-"timeout:	\n"
+"error:	\n"
+		"	clr %0					\n"
+"done:	\n"
 "			pop r31				\n" // restore z
 "			pop r30				\n" // restore z
 
-		: 	"=&r" (count)						// %0
-		: 	"z" ((unsigned char volatile *)gcn64_workbuf),		// %1
-			"I" (_SFR_IO_ADDR(GCN64_DATA_PIN)),	// %2
-			"I" (_SFR_IO_ADDR(PORTB)),			// %3
-			"M" (TIMING_OFFSET)					// %4
-		: 	"r16"
+		: 	"=&d" (count),						// %0
+			"=&d" (partial)						// %1
+		: 	"z" (gcn64_rxbuf),					// %2
+			"I" (_SFR_IO_ADDR(GC_DATA_PIN)),	// %3
+			"I" (_SFR_IO_ADDR(PORTB)),			// %4
+			"M" (TIMING_OFFSET),				// %5
+			"M" (GCN64_MAX_RX_BITS + 1),		// %6
+			"I" (GC_DATA_BIT_NUM)				// %7
+		: 	"r16", "r17", "memory"
 	);
+#endif
+
+	if (count > GCN64_MAX_RX_BITS)
+		return 0;
+
+	// left-align a trailing partial byte. The sentinel is shifted out.
+	if (count & 7) {
+		gcn64_rxbuf[count >> 3] = partial << (8 - (count & 7));
+	}
 
 	return count;
 }
 
-static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
+#if defined(HOST_BUILD)
+static char gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
+{
+	if (n_bytes == 0 || n_bytes > GCN64_MAX_TX_BYTES)
+		return 1;
+
+	host_gcn64_command(data, n_bytes);
+
+	return 0;
+}
+#elif defined(GC_TX_USART)
+/**
+ * \brief Send n data bytes + stop bit using the USART in master SPI mode
+ * \return 0 on success, 1 if the command could not be sent
+ *
+ * The whole command is encoded to USART symbols first. The USART has one
+ * byte of buffering in addition to the shift register, so the sending
+ * loop (and interrupts which preempt it) have 8 to 16 us to provide each
+ * byte. If it comes too late, the line is released mid-command (TXC0
+ * sets before the end), and this is reported as a failure.
+ *
+ * The INT0 handler of the default NES wiring lasts for the whole read,
+ * much longer than this, so a latch during a command always breaks it.
+ * The transaction is then retried (see gcn64_transaction). Use
+ * NES_SERVE_SPI to avoid this.
+ */
+static char gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
+{
+	unsigned char i, b, len = 0;
+	volatile unsigned char *out = gcn64_workbuf;
+
+	if (n_bytes == 0 || n_bytes > GCN64_MAX_TX_BYTES)
+		return 1;
+
+	for (i=0; i<n_bytes; i++) {
+		for (b=0; b<8; b+=2) {
+			*out = (((data[i] << b) & 0x80) ? GC_TX_SYM_1 : GC_TX_SYM_0) << 4;
+			*out |= ((data[i] << b) & 0x40) ? GC_TX_SYM_1 : GC_TX_SYM_0;
+			out++;
+			len++;
+		}
+	}
+	*out = GC_TX_STOP;
+	len++;
+
+	UCSR0A = (1<<TXC0); // clear
+
+	for (i=0, out=gcn64_workbuf; i<len; i++) {
+		while (!(UCSR0A & (1<<UDRE0))) { }
+		if (UCSR0A & (1<<TXC0)) {
+			// underrun: the line went high in the middle of a bit
+			return 1;
+		}
+		UDR0 = *out;
+		out++;
+	}
+
+	// The last byte (stop bit) is now in the shift register. If the
+	// shift register emptied before it was written, the last data byte
+	// was followed by a released line. This is only seen now.
+	while (!(UCSR0A & (1<<UDRE0))) { }
+	if (UCSR0A & (1<<TXC0)) {
+		return 1;
+	}
+
+	// The low part of the stop bit lasts 1us. Wait until the line is
+	// high to prevent the reception code from thinking this is the
+	// beginning of the first reply bit.
+	_delay_us(1);
+	for (i=0xff; i; i--) {
+		if (GC_DATA_PIN & GC_DATA_BIT)
+			break;
+	}
+
+	return 0;
+}
+#else
+static char gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 {
 	unsigned int bits;
 
 	if (n_bytes == 0)
-		return;
+		return 1;
 
 	// Explode the data to one byte per bit for very easy transmission in assembly.
 	// This trades memory for ease of implementation.
 	bits = bitsToWorkbufBytes(data, n_bytes, 0);
 	if (!bits)
-		return;
+		return 1;
 
 	// the value of the gpio is pre-configured to low. We simulate
 	// an open drain output by toggling the direction.
-#define PULL_DATA		"	sbi %0, 5               \n"
-#define RELEASE_DATA	"	cbi %0, 5               \n"
+#define PULL_DATA		"	sbi %0, %4               \n"
+#define RELEASE_DATA	"	cbi %0, %4               \n"
 
 	// busy looping delays based on busy loop and nop tuning.
 	// valid for 12Mhz clock.
@@ -264,116 +661,146 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	"sb_waitHigh%=:			\n"
 	"	dec r16				\n" // decrement timeout
 	"	breq sb_wait_high_done%=		\n" // handle timeout condition
-	"	sbis %3, 5			\n" // Read the port
+	"	sbis %3, %4			\n" // Read the port
 	"	rjmp sb_waitHigh%=	\n"
 "sb_wait_high_done%=:\n"
 	:
-	: "I" (_SFR_IO_ADDR(GCN64_DATA_DDR)), // %0
+	: "I" (_SFR_IO_ADDR(GC_DATA_DDR)), // %0
 	  "w" (bits),						// %1
 	  "z" ((unsigned char volatile *)gcn64_workbuf),					// %2
-	  "I" (_SFR_IO_ADDR(GCN64_DATA_PIN))	// %3
+	  "I" (_SFR_IO_ADDR(GC_DATA_PIN)),	// %3
+	  "I" (GC_DATA_BIT_NUM)				// %4
 	: "r16", "r17");
-}
 
-/* \brief Decode the received length of low/high states to byte-per-bit format
- *
- * The result is in workbuf.
- *
- **/
-static void gcn64_decodeWorkbuf(unsigned char count)
-{
-	unsigned char i;
-	volatile unsigned char *output = gcn64_workbuf;
-	volatile unsigned char *input = gcn64_workbuf;
-	unsigned char t;
-
-    //  
-    //          ________
-    // ________/
-    //  
-    //   [i*2]    [i*2+1]
-    //  
-    //          ________________
-    // 0 : ____/
-    //                      ____
-    // 1 : ________________/
-    //  
-    // The timings on a real N64 are
-    //  
-    // 0 : 1 us low, 3 us high
-    // 1 : 3 us low, 1 us high
-    //  
-    // However, HORI pads use something similar to
-    //  
-    // 0 : 1.5 us low, 4.5 us high
-    // 1 : 4.5 us low, 1.5 us high
-    //  
-    //  
-    // No64 us = microseconds
-
-	// This operation takes approximately 100uS on 64bit gamecube messages
-	for (i=0; i<count; i++) {
-		t = *input; 
-		input++;
-
-		*output = t < *input;
-
-		input++;
-		output++;
-	}
+	return 0;
 }
+#endif
 
 void gcn64protocol_hwinit(void)
 {
 	// data as input
-	GCN64_DATA_DDR &= ~(GCN64_DATA_BIT);
+	GC_DATA_DDR &= ~(GC_DATA_BIT);
 
 	// keep data low. By toggling the direction, we make the
 	// pin act as an open-drain output.
-	GCN64_DATA_PORT &= ~GCN64_DATA_BIT;
+	GC_DATA_PORT &= ~GC_DATA_BIT;
+
+#ifdef GC_TX_USART
+	// The data pin is only read. TXD0 drives the line through an
+	// open-drain buffer. Master SPI mode requires XCK0 to be an
+	// output, and UBRR0 to be 0 when the transmitter is enabled.
+	UBRR0 = 0;
+	DDRD |= (1<<PD4);
+	UCSR0C = (1<<UMSEL01) | (1<<UMSEL00); // MSb first, mode 0
+	UCSR0B = (1<<TXEN0);
+	UBRR0 = GC_TX_UBRR;
+#endif
+
+#ifdef GC_RX_ICP
+	// The replies are timed by Timer1. sync_init() only runs after
+	// the power-up reads, so the timer must be started here.
+	TCCR1A = 0;
+	TCCR1B = SYNC_TIMER_CS;
+#endif
 	
+#ifndef NES_SERVE_SPI
 	/* debug bit PORTB4 (MISO) */
 	DDRB |= 0x10;
 	PORTB &= ~0x10;
+#endif
 }
 
 
 
+void gcn64_setRetryHook(char (*hook)(void))
+{
+	gcn64_retry_hook = hook;
+}
+
+char gcn64_wasPreempted(void)
+{
+	return gcn64_preempted;
+}
+
+void gcn64_getStats(struct gcn64_stats *dst)
+{
+	memcpy(dst, &gcn64_stats, sizeof(struct gcn64_stats));
+}
+
+/* Wait until the controller is done sending what remains of a reply
+ * (the line stays high for 10us). Bounded in case the line is stuck. */
+static void gcn64_waitIdle(void)
+{
+	unsigned char high = 0;
+	unsigned int guard = 1000;
+
+	while (high < 10 && --guard) {
+		if (GC_DATA_PIN & GC_DATA_BIT) {
+			high++;
+		} else {
+			high = 0;
+		}
+		_delay_us(1);
+	}
+}
+
 /**
  * \brief Send n data bytes + stop bit, wait for answer.
  * \return The number of bits received, 0 on timeout/error.
  *
- * The result is in gcn64_workbuf, where each byte represents
- * a bit.
+ * The result is read with gcn64_protocol_getByte/getBytes.
  */
 int gcn64_transaction(unsigned char *data_out, int data_out_len)
 {
-	int count;
+	int count = 0;
+	unsigned char irq_count, tries = 0;
+	char failed;
+#ifdef GC_RX_ICP
+	unsigned char sent_irq_count;
+#endif
 
-	gcn64_sendBytes(data_out, data_out_len);
-	count = gcn64_receive();
-	if (!count)
-		return 0;
+	while (1) {
+		irq_count = gcn64_irq_count;
 
-	if (!(count & 0x01)) {
-		// If we don't get an odd number of level lengths from gcn64_receive
-		// something is wrong. 
-		//
-		// The stop bit is a short (~1us) low state followed by an "infinite"
-		// high state, which timeouts and lets the function return. This
-		// is why we should receive and odd number of lengths.
-		return 0;
+		failed = gcn64_sendBytes(data_out, data_out_len);
+#ifdef GC_RX_ICP
+		sent_irq_count = gcn64_irq_count;
+#endif
+		if (!failed) {
+			count = gcn64_receive();
+		}
+
+		gcn64_preempted = irq_count != gcn64_irq_count;
+#ifdef GC_RX_ICP
+		/* The reply is timed by the capture unit. If it could be
+		 * decoded, interrupts during the reception did not break it. */
+		if (count && sent_irq_count == irq_count)
+			gcn64_preempted = 0;
+#endif
+		if (!gcn64_preempted)
+			break;
+
+		/* The reply (if any) may be corrupt. Discard it. */
+		gcn64_stats.preempted++;
+		if (tries++ >= GCN64_MAX_RETRIES ||
+				!gcn64_retry_hook || !gcn64_retry_hook()) {
+			gcn64_stats.aborts++;
+			return 0;
+		}
+		gcn64_stats.retries++;
+		gcn64_waitIdle();
 	}
 
-	gcn64_decodeWorkbuf(count);
-	
+	if (failed || !count)
+		return 0;
+
 	/* this delay is required on N64 controllers. Otherwise, after sending
 	 * a rumble-on or rumble-off command (probably init too), the following
 	 * get status fails. This starts to work at 2us. 5 should be safe. */
 	_delay_us(5);
 	
 	/* return the number of full bits received. */
-	return (count-1) / 2;
+	return count;
 }
 
 
@@ -158,10 +158,28 @@
 
 #define GC_KEY_ENTER			0x61
 
+/* Interrupt handlers which may run during a transaction must call
+ * GCN64_IRQ_MARK(). A transaction during which one ran is considered
+ * preempted: its timing was broken and the reply is discarded. */
+extern volatile unsigned char gcn64_irq_count;
+#define GCN64_IRQ_MARK()	do { gcn64_irq_count++; } while(0)
+
+struct gcn64_stats {
+	unsigned int preempted;	// transactions discarded
+	unsigned int retries;	// and tried again
+	unsigned int aborts;	// and given up
+};
+
 void gcn64protocol_hwinit(void);
 int gcn64_detectController(void);
 int gcn64_transaction(unsigned char *data_out, int data_out_len);
 
+/* The hook decides whether a preempted transaction may be retried
+ * right away (non-zero) or given up. Without a hook, it is given up. */
+void gcn64_setRetryHook(char (*hook)(void));
+char gcn64_wasPreempted(void);
+void gcn64_getStats(struct gcn64_stats *dst);
+
 unsigned char gcn64_protocol_getByte(int offset);
 void gcn64_protocol_getBytes(int offset, int n_bytes, unsigned char *dstbuf);
 
@@ -0,0 +1,16 @@
+#ifndef _hal_h__
+#define _hal_h__
+
+/* The firmware uses the AVR registers directly. With HOST_BUILD, they
+ * are variables instead (see host/hostio.h), so the mapping, sync and
+ * protocol code can be compiled and run on a PC. */
+#ifdef HOST_BUILD
+#include "hostio.h"
+#else
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#endif
+
+#endif // _hal_h__
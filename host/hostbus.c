@@ -0,0 +1,104 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The controller at the other end of the gamecube/N64 bus of the host
+ * build. It answers the commands sent by gcn64_protocol.c with the
+ * identity and status set by hostbus_setPad(). */
+
+#include <string.h>
+#include "hostio.h"
+#include "hostbus.h"
+#include "gcn64_protocol.h"
+
+/* Bits sent by the controller: 0 is 3us low and 1us high, 1 is 1us low
+ * and 3us high. The line stays high after the stop bit. */
+#define BIT_SHORT_US	1.0
+#define BIT_LONG_US		3.0
+#define IDLE_US			1000.0
+
+#define MAX_COMMAND		8
+
+static struct hostbus_pad pad;
+static unsigned char command[MAX_COMMAND];
+static int command_len;
+static int preempt;
+
+void hostbus_setPad(const struct hostbus_pad *p)
+{
+	pad = *p;
+}
+
+void hostbus_preempt(int n)
+{
+	preempt = n;
+}
+
+void host_gcn64_command(const unsigned char *data, int n_bytes)
+{
+	if (n_bytes > MAX_COMMAND)
+		n_bytes = MAX_COMMAND;
+	memcpy(command, data, n_bytes);
+	command_len = n_bytes;
+}
+
+static int hostbus_bytes(struct host_bit *bits, int max_bits,
+							const unsigned char *bytes, int n_bytes)
+{
+	int i, n = 0;
+
+	for (i=0; i<n_bytes * 8 && n < max_bits - 1; i++, n++) {
+		if (bytes[i >> 3] & (0x80 >> (i & 7))) {
+			bits[n].low_us = BIT_SHORT_US;
+			bits[n].high_us = BIT_LONG_US;
+		} else {
+			bits[n].low_us = BIT_LONG_US;
+			bits[n].high_us = BIT_SHORT_US;
+		}
+	}
+
+	bits[n].low_us = BIT_SHORT_US;
+	bits[n].high_us = IDLE_US;
+
+	return n + 1;
+}
+
+int host_gcn64_reply(struct host_bit *bits, int max_bits)
+{
+	if (preempt) {
+		preempt--;
+		GCN64_IRQ_MARK();
+	}
+
+	if (!pad.present || command_len < 1)
+		return 0;
+
+	switch (command[0])
+	{
+		case GC_GETID: // also N64_GET_CAPABILITIES
+			return hostbus_bytes(bits, max_bits, pad.id, sizeof(pad.id));
+
+		case N64_GET_STATUS:
+			return hostbus_bytes(bits, max_bits, pad.status, 4);
+
+		case GC_GETSTATUS1:
+			if (command_len != 3)
+				return 0;
+			return hostbus_bytes(bits, max_bits, pad.status, sizeof(pad.status));
+	}
+
+	return 0;
+}
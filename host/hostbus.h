@@ -0,0 +1,16 @@
+#ifndef _hostbus_h__
+#define _hostbus_h__
+
+/* The controller answering the host build */
+struct hostbus_pad {
+	char present;
+	unsigned char id[3];		// GC_GETID / N64_GET_CAPABILITIES reply
+	unsigned char status[8];	// GC_GETSTATUS reply. The first 4 bytes for N64_GET_STATUS.
+};
+
+void hostbus_setPad(const struct hostbus_pad *p);
+
+/* The next n replies are interrupted, as by the latch interrupt. */
+void hostbus_preempt(int n);
+
+#endif // _hostbus_h__
@@ -0,0 +1,27 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "hostio.h"
+
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t GIFR, GICR, MCUCR;
+volatile uint8_t TIFR, TIMSK;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile unsigned int TCNT1, OCR1A, ICR1;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t SREG;
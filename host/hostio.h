@@ -0,0 +1,69 @@
+#ifndef _hostio_h__
+#define _hostio_h__
+
+/* Stand-ins for the AVR registers and support library, for building the
+ * firmware on a PC (HOST_BUILD). The registers are plain variables
+ * (ATmega8 names) which the host program sets and inspects.
+ *
+ * Nothing else is simulated: interrupt flags are not set by hardware and
+ * writing one to them sets them instead of clearing them, so the code
+ * waiting for one returns at once. Delays return immediately. */
+
+#include <stdint.h>
+
+#define HOST_REG8(n)	extern volatile uint8_t n
+/* int is 16-bit on the AVR. The code computes the difference of two
+ * timer values as unsigned int, which only wraps like the timer does
+ * when both are the same width. Timer1 is therefore as wide as an int
+ * here (it counts for hours before wrapping). */
+#define HOST_REG16(n)	extern volatile unsigned int n
+
+HOST_REG8(PORTB); HOST_REG8(DDRB); HOST_REG8(PINB);
+HOST_REG8(PORTC); HOST_REG8(DDRC); HOST_REG8(PINC);
+HOST_REG8(PORTD); HOST_REG8(DDRD); HOST_REG8(PIND);
+HOST_REG8(GIFR); HOST_REG8(GICR); HOST_REG8(MCUCR);
+HOST_REG8(TIFR); HOST_REG8(TIMSK);
+HOST_REG8(TCCR1A); HOST_REG8(TCCR1B);
+HOST_REG16(TCNT1); HOST_REG16(OCR1A); HOST_REG16(ICR1);
+HOST_REG8(SPCR); HOST_REG8(SPSR); HOST_REG8(SPDR);
+HOST_REG8(SREG);
+
+/* GICR, GIFR, MCUCR */
+#define INT1	7
+#define INT0	6
+#define INTF0	6
+#define ISC01	1
+#define ISC00	0
+
+/* TIFR, TCCR1B */
+#define OCF1A	4
+#define TOV1	2
+#define ICES1	6
+#define CS12	2
+#define CS11	1
+#define CS10	0
+
+/* SPCR */
+#define SPIE	7
+#define SPE		6
+#define MSTR	4
+#define CPOL	3
+
+#define ISR(vect)		void vect(void)
+#define cli()			do { } while (0)
+#define sei()			do { } while (0)
+#define _delay_us(us)	do { } while (0)
+#define _delay_ms(ms)	do { } while (0)
+
+/* The bus (host/hostbus.c) replaces the assembly code of
+ * gcn64_protocol.c. A reply is a list of bits, the last one being the
+ * stop bit, with the length of their low and high levels. */
+struct host_bit {
+	float low_us;
+	float high_us;
+};
+
+void host_gcn64_command(const unsigned char *data, int n_bytes);
+int host_gcn64_reply(struct host_bit *bits, int max_bits);
+
+#endif // _hostio_h__
@@ -0,0 +1,275 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Host build: checks the mapping, the gamecube report building, the
+ * reply decoding, the controller detection, the retry of preempted
+ * transactions and the frame estimator of sync.c, then times them. Returns non-zero if a check fails. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal.h"
+#include "hostbus.h"
+#include "gcn64_protocol.h"
+#include "gamecube.h"
+#include "sync.h"
+
+/* main.c */
+extern unsigned char gc_report[GCN64_REPORT_SIZE];
+void doMapping();
+unsigned char hostNesByte();
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf("  FAIL: " __VA_ARGS__); \
+			putchar('\n'); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Status reply with all axis centered and the given buttons (first two
+ * bytes, see gamecubeUpdate) */
+static void padWithButtons(struct hostbus_pad *p, unsigned char b1, unsigned char b2)
+{
+	static const unsigned char id[3] = { 0x09, 0x00, 0x20 };
+
+	memset(p, 0, sizeof(struct hostbus_pad));
+	p->present = 1;
+	memcpy(p->id, id, sizeof(id));
+	p->status[0] = b1;
+	p->status[1] = 0x80 | b2;
+	memset(p->status + 2, 0x80, 4);
+	p->status[6] = 0x20; // triggers released
+	p->status[7] = 0x20;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCH(name, iterations, body) do { \
+		long _i, _n = (iterations); \
+		double _t = now_s(); \
+		for (_i=0; _i<_n; _i++) { body; } \
+		_t = now_s() - _t; \
+		printf("  %-28s %10.1f ns/call %8.2f M/s\n", name, \
+				_t * 1e9 / _n, _n / _t / 1e6); \
+	} while (0)
+
+static void checkDetect(void)
+{
+	static const struct {
+		unsigned char id[3];
+		int expected;
+	} ids[] = {
+		{ { 0x09, 0x00, 0x20 }, CONTROLLER_IS_GC },
+		{ { 0xE9, 0xA0, 0x17 }, CONTROLLER_IS_GC }, // Wavebird on
+		{ { 0xA8, 0x00, 0x00 }, CONTROLLER_IS_GC }, // Wavebird off
+		{ { 0x05, 0x00, 0x01 }, CONTROLLER_IS_N64 },
+		{ { 0x08, 0x20, 0x00 }, CONTROLLER_IS_GC_KEYBOARD },
+		{ { 0x03, 0x00, 0x00 }, CONTROLLER_IS_UNKNOWN },
+	};
+	struct hostbus_pad p;
+	int i, res;
+
+	printf("Controller detection\n");
+	for (i=0; i<sizeof(ids)/sizeof(ids[0]); i++) {
+		padWithButtons(&p, 0, 0);
+		memcpy(p.id, ids[i].id, 3);
+		hostbus_setPad(&p);
+		res = gcn64_detectController();
+		CHECK(res == ids[i].expected, "id %02x%02x%02x detected as %d, expected %d",
+				ids[i].id[0], ids[i].id[1], ids[i].id[2], res, ids[i].expected);
+	}
+
+	p.present = 0;
+	hostbus_setPad(&p);
+	res = gcn64_detectController();
+	CHECK(res == CONTROLLER_IS_ABSENT, "no controller detected as %d", res);
+}
+
+static void checkMapping(void)
+{
+	static const struct {
+		const char *name;
+		unsigned char b1, b2;	// gamecube status
+		unsigned char nes;		// active low
+	} cases[] = {
+		{ "none",		0x00, 0x00, 0xff },
+		{ "A",			0x01, 0x00, 0x7f },
+		{ "B",			0x02, 0x00, 0xbf },
+		{ "Start",		0x10, 0x00, 0xef },
+		{ "Z",			0x00, 0x10, 0xdf },
+		{ "Up Left",	0x00, 0x09, 0xf5 },
+		{ "A B",		0x03, 0x00, 0x3f },
+	};
+	struct hostbus_pad p;
+	Gamepad *gcpad = gamecubeGetGamepad();
+	int i;
+
+	printf("Report building and mapping\n");
+	for (i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+		padWithButtons(&p, cases[i].b1, cases[i].b2);
+		hostbus_setPad(&p);
+
+		CHECK(gcpad->update() == 0, "%s: update failed", cases[i].name);
+		gcpad->buildReport(gc_report, 0);
+		doMapping();
+		CHECK(hostNesByte() == cases[i].nes, "%s: NES byte %02x, expected %02x",
+				cases[i].name, hostNesByte(), cases[i].nes);
+	}
+
+	CHECK(gamecubeGetKind() == GC_KIND_WIRED, "kind %d, expected wired", gamecubeGetKind());
+
+	p.status[2] = 0x00; // stick left
+	hostbus_setPad(&p);
+	gcpad->update();
+	gcpad->buildReport(gc_report, 0);
+	doMapping();
+	CHECK(!(hostNesByte() & (0x80 >> 6)), "stick left not mapped: %02x", hostNesByte());
+}
+
+static char retryAlways(void)
+{
+	return 1;
+}
+
+static char retryNever(void)
+{
+	return 0;
+}
+
+/* A preempted transaction is retried when the hook allows it, given up
+ * otherwise. The counters of gcn64_getStats() must tell which. */
+static void checkPreemption(void)
+{
+	struct gcn64_stats before, after;
+	struct hostbus_pad p;
+	int res;
+
+	printf("Preempted transactions\n");
+	padWithButtons(&p, 0, 0);
+	hostbus_setPad(&p);
+	gcn64_getStats(&before);
+
+	gcn64_setRetryHook(retryAlways);
+	hostbus_preempt(1);
+	res = gcn64_detectController();
+	CHECK(res == CONTROLLER_IS_GC, "retried transaction detected as %d", res);
+
+	gcn64_setRetryHook(retryNever);
+	hostbus_preempt(1);
+	res = gcn64_detectController();
+	CHECK(res == CONTROLLER_IS_ABSENT, "given up transaction detected as %d", res);
+
+	gcn64_setRetryHook(NULL);
+	gcn64_getStats(&after);
+	after.preempted -= before.preempted;
+	after.retries -= before.retries;
+	after.aborts -= before.aborts;
+	printf("  preempted %u, retried %u, given up %u\n",
+			after.preempted, after.retries, after.aborts);
+	CHECK(after.preempted == 2 && after.retries == 1 && after.aborts == 1,
+			"counters %u %u %u, expected 2 1 1",
+			after.preempted, after.retries, after.aborts);
+}
+
+/* Latch at the given period (in timer ticks) and call the estimator as
+ * the main loop would, every 'step' ticks. Returns the standard found. */
+static unsigned char runFrames(unsigned int period, unsigned int step, int frames)
+{
+	unsigned int next = TCNT1 + period;
+	int i;
+
+	for (i=0; i<frames; i++) {
+		while ((unsigned int)(next - TCNT1) > step) {
+			TCNT1 += step;
+			sync_master_polled_us();
+		}
+		TCNT1 = next;
+		sync_latch_event(TCNT1);
+		TCNT1 += 2;
+		sync_latch_done(TCNT1);
+		next += period;
+	}
+
+	return sync_standard();
+}
+
+static void checkSync(void)
+{
+	unsigned char std;
+
+	printf("Frame estimator\n");
+
+	sync_init();
+	std = runFrames(US_TO_TICKS(16639L), US_TO_TICKS(100L), 20);
+	CHECK(sync_locked(), "not locked on NTSC frames");
+	CHECK(std == SYNC_STD_NTSC, "standard %d, expected NTSC", std);
+
+	std = runFrames(US_TO_TICKS(19997L), US_TO_TICKS(100L), 20);
+	CHECK(std == SYNC_STD_PAL, "standard %d, expected PAL", std);
+
+	sync_init();
+	std = runFrames(US_TO_TICKS(5000L), US_TO_TICKS(100L), 20);
+	CHECK(std == SYNC_STD_UNKNOWN, "standard %d at 200Hz", std);
+}
+
+int main(int argc, char **argv)
+{
+	long n = 1000000;
+	struct hostbus_pad p;
+	Gamepad *gcpad = gamecubeGetGamepad();
+	unsigned int period = US_TO_TICKS(16639L);
+
+	if (argc > 1)
+		n = strtol(argv[1], NULL, 0);
+
+	checkDetect();
+	checkMapping();
+	checkPreemption();
+	checkSync();
+
+	printf("Timing (%ld iterations)\n", n);
+
+	padWithButtons(&p, 0x01, 0x09);
+	hostbus_setPad(&p);
+
+	BENCH("gcn64_detectController", n, gcn64_detectController());
+	BENCH("gamecube update+report", n, gcpad->update(); gcpad->buildReport(gc_report, 0));
+	BENCH("doMapping", n, doMapping());
+
+	sync_init();
+	BENCH("sync_master_polled_us", n,
+			TCNT1 += US_TO_TICKS(100L);
+			if ((unsigned int)(TCNT1 % period) < US_TO_TICKS(100L)) sync_latch_event(TCNT1);
+			sync_master_polled_us());
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -16,9 +16,7 @@
 */
 #include <stdio.h>
 #include <string.h>
-#include <util/delay.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 
 #include "gcn64_protocol.h"
 #include "gamecube.h"
@@ -26,8 +24,13 @@
 #include "sync.h"
 #include "atmega168compat.h"
 
+#ifdef NES_SERVE_SPI
+#define DEBUG_LOW()
+#define DEBUG_HIGH()
+#else
 #define DEBUG_LOW()		PORTB &= ~(1<<5);
 #define DEBUG_HIGH()	PORTB |= (1<<5);
+#endif
 
 #ifdef AT168_COMPATIBLE
 	#define COMPAT_GIFR	EIFR
@@ -43,15 +46,32 @@ static volatile unsigned char g_nes_polled = 0;
 static volatile unsigned char g_turbo_on = 0;
 static volatile unsigned char int_counter = 0;
 
-static volatile unsigned char nesbyte = 0xff;
 static volatile unsigned char reuse;
 
-#define NES_DATA_PORT 	PORTC
-#define NES_DATA_BIT	0
-#define NES_CLOCK_BIT	1
-#define NES_CLOCK_PIN	PINC
-#define NES_LATCH_PIN	PIND
-#define NES_LATCH_BIT	2
+/* Raw mode: the complete gamecube report follows the 8 standard bits. The
+ * console inverts what it reads on the data line, so the report is kept
+ * complemented here for the game to read the bytes as they are. */
+static volatile unsigned char g_raw_mode = 0;
+
+/* What is served to the NES: the NES byte followed by the raw report.
+ *
+ * The interrupt handler only reads nes_buf[nes_cur]. The main loop builds
+ * the next data in nes_work, copies it to the other buffer and switches
+ * nes_cur with a single store, so a latch never sees a partial update.
+ */
+#define NES_SERIAL_BYTES	(1 + GCN64_REPORT_SIZE)
+static volatile unsigned char nes_buf[2][NES_SERIAL_BYTES] = { { 0xff }, { 0xff } };
+static volatile unsigned char nes_cur;
+static unsigned char nes_work[NES_SERIAL_BYTES] = { 0xff };
+
+/* Tap capture: every button seen pressed (low) by a poll since the
+ * console last started reading is kept here, and served along with
+ * the current state. Cleared when a new frame starts. */
+static unsigned char tap_mask[NES_SERIAL_BYTES];
+#ifndef HOST_BUILD
+static unsigned char g_tap_mode = 0;
+static unsigned char tap_frame;
+#endif
 
 #define NES_BIT_A		0
 #define NES_BIT_B		1
@@ -63,9 +83,76 @@ static volatile unsigned char reuse;
 #define NES_BIT_RIGHT	7
 
 
+#ifdef NES_SERVE_SPI
+
+/* Raw report bytes still to be loaded in SPDR for the current read, and
+ * the buffer they come from. */
+static unsigned char volatile *spi_next;
+static volatile unsigned char spi_left;
+static volatile unsigned char spi_buf;
+
+ISR(INT0_vect)
+{
+	unsigned char dat;
+
+	GCN64_IRQ_MARK();
+
+	if (g_turbo_on) {
+		int_counter++;
+	}
+
+	/* SS follows the latch, so the SPI is idle and SPDR can be
+	 * written. The first bit appears on MISO when the latch falls.
+	 * A latch in the middle of a read restarts the SPI the same way. */
+	spi_buf = nes_cur;
+	spi_next = nes_buf[spi_buf];
+	dat = *spi_next++;
+
+	if (g_turbo_on) {
+		if (int_counter&0x4) {
+			dat |= 0xc0;
+		}
+	}
+
+	SPDR = dat;
+	spi_left = g_raw_mode ? GCN64_REPORT_SIZE : 0;
+
+	sync_latch_event(TCNT1);
+
+	/* Let the main loop know about this interrupt occuring. */
+	g_nes_polled = 1;
+}
+
+ISR(SPI_STC_vect)
+{
+	/* 8 bits were clocked out. The next byte must be loaded before
+	 * the next falling clock edge. Past the end of the report, MOSI
+	 * (grounded) is shifted in and the data line stays low. */
+	GCN64_IRQ_MARK();
+
+	if (spi_left) {
+		SPDR = *spi_next++;
+		spi_left--;
+	} else {
+		sync_latch_done(TCNT1);
+	}
+}
+
+#else
+
 ISR(INT0_vect)
 {
 	unsigned char bit, dat;
+	unsigned char left, next, cur;
+	unsigned char volatile *raw;
+	unsigned char volatile *serve;
+	unsigned int first, last;
+	unsigned char relatches;
+
+	/* Only the time of the latch is taken now. The rest of the
+	 * bookkeeping (sync.h, GCN64_IRQ_MARK) waits until the read is over
+	 * (int0_done): nothing goes between the latch and the clock loop. */
+	first = TCNT1;
 
 	//DEBUG_HIGH();
 
@@ -82,6 +169,10 @@ ISR(INT0_vect)
 	// I think no pause is better than no-exit pause? Ah if I had a shift register
 	// on board it would be easier.
 	//
+	// The main loop now polls in the idle time such games leave between
+	// reads, when it recurs (see sync_may_steal()). This remains for
+	// the games where it doesn't.
+	//
 	reuse++;
 	if (reuse==0xff) {
 		// reuse is cleared each time we perform a read from the gamecube controller.
@@ -95,13 +186,23 @@ ISR(INT0_vect)
 		// This also looks like no controller to the game.
 		NES_DATA_PORT |= (1<<NES_DATA_BIT);
 
+		GCN64_IRQ_MARK();
 		return;
 	}
 #endif
 
+	last = first;
+	relatches = 0;
+	goto latched;
+
 relatch:
+	// A latch before the end of the read
+	last = TCNT1;
+	relatches++;
+latched:
 	COMPAT_GIFR |= (1<<INTF0);
-	dat = nesbyte;
+	serve = nes_cur ? nes_buf[1] : nes_buf[0];
+	dat = serve[0];
 
 	if (g_turbo_on) {
 		if (int_counter&0x4) {
@@ -124,9 +225,17 @@ relatch:
 		NES_DATA_PORT &= ~(1<<NES_DATA_BIT);
 	}
 
-
-
-	dat <<= 1;
+	/* dat always holds what goes out on the next 8 falling edges. The
+	 * 8th edge presents the first bit of the following byte (or 0, as
+	 * an original controller does once its shift register is empty),
+	 * so in raw mode the next byte is fetched during the clock period
+	 * following an edge, never between an edge and its data. */
+	raw = serve + 1;
+	left = g_raw_mode ? GCN64_REPORT_SIZE : 0;
+	next = left ? *raw++ : 0;
+
+	dat = (dat << 1) | (next >> 7);
+nextbyte:
 	for (bit=0x80; bit; bit>>=1) 
 	{
 
@@ -1560,15 +1669,31 @@ dobit1:
 			NES_DATA_PORT &= ~(1<<NES_DATA_BIT);
 		}
 	}	
-	
+
+	if (left--) {
+		cur = next;
+		next = left ? *raw++ : 0;
+		dat = (cur << 1) | (next >> 7);
+		goto nextbyte;
+	}
 
 int0_done:
+	/* Latches during the read are recorded as one, at the time of the
+	 * last of them. */
+	sync_latch_event(first);
+	if (relatches) {
+		sync_latch_event(last);
+	}
+	sync_latch_done(TCNT1);
+	GCN64_IRQ_MARK();
 
 	/* Let the main loop know about this interrupt occuring. */
 	g_nes_polled = 1;
 	//DEBUG_LOW();
 }
 
+#endif // NES_SERVE_SPI
+
 
 void byteTo8Bytes(unsigned char val, unsigned char volatile *dst)
 {
@@ -1589,9 +1714,9 @@ unsigned char scaleValue(unsigned char raw)
 void toNes(int pressed, int nes_btn_id)
 {
 	if (pressed)
-		nesbyte &= ~(0x80 >> nes_btn_id);
+		nes_work[0] &= ~(0x80 >> nes_btn_id);
 	else
-		nesbyte |= (0x80 >> nes_btn_id);
+		nes_work[0] |= (0x80 >> nes_btn_id);
 
 }
 
@@ -1634,6 +1759,59 @@ void axisToNes_mario(unsigned char val, int nes_btn_low, int nes_btn_high, int n
 
 static int cur_mapping = MAPPING_DEFAULT;
 
+void rawUpdate()
+{
+	unsigned char i;
+
+	for (i=0; i<GCN64_REPORT_SIZE; i++) {
+		nes_work[1 + i] = gc_report[i] ^ 0xff;
+	}
+}
+
+char nesPublish()
+{
+	unsigned char i, next = nes_cur ^ 1;
+	unsigned char sreg;
+	char published;
+
+#ifdef NES_SERVE_SPI
+	/* Reads no longer block the main loop, so the other buffer may still
+	 * be in use by a raw report read started before the last switch. */
+	if (spi_left && spi_buf == next)
+		return 0;
+#endif
+
+	for (i=0; i<NES_SERIAL_BYTES; i++) {
+		nes_buf[next][i] = nes_work[i] & tap_mask[i];
+	}
+
+	/* Keep the data unchanged until the game is done reading it
+	 * repeatedly. */
+	sreg = SREG;
+	cli();
+	published = sync_may_publish();
+	if (published) {
+		nes_cur = next;
+	}
+	SREG = sreg;
+
+	return published;
+}
+
+void tapReset()
+{
+	memset(tap_mask, 0xff, sizeof(tap_mask));
+}
+
+void tapCapture()
+{
+	/* The NES byte and the raw button bytes. The axis values are not
+	 * buttons and are served as they are. */
+	tap_mask[0] &= nes_work[0];
+	tap_mask[1 + 6] &= nes_work[1 + 6];
+	tap_mask[1 + 7] &= nes_work[1 + 7];
+}
+
 void doMapping()
 {
 	switch(cur_mapping) {
@@ -1692,8 +1870,19 @@ void doMapping()
 	}
 }
 
+#ifdef HOST_BUILD
+/* The byte doMapping() built, for host/hostmain.c */
+unsigned char hostNesByte()
+{
+	return nes_work[0];
+}
+#endif
+
+#ifndef HOST_BUILD
 int main(void)
 {
+	unsigned char publish_pending = 0;
+	char changed, may_sample;
 	
 	gcpad = gamecubeGetGamepad();
 
@@ -1703,6 +1892,24 @@ int main(void)
 	DDRD = 0;
 	PORTD = 0xff;
 
+#ifdef NES_SERVE_SPI
+	/* PORTB
+	 * 2: SS, NES Latch (input)
+	 * 3: MOSI (grounded)
+	 * 4: MISO, NES Data (output)
+	 * 5: SCK, NES Clock (input)
+	 */
+	DDRB = 0;
+	PORTB = 0xff & ~(1<<3);
+	DDRB = 1<<NES_DATA_BIT;
+
+	DDRC = 0;
+	PORTC = 0xff;
+
+	// SPI slave, MSb first. Clock idles high, data changes on
+	// the rising edge like the 4021 in original controllers.
+	SPCR = (1<<SPE) | (1<<SPIE) | (1<<CPOL);
+#else
 	DDRB = 0;
 	PORTB = 0xff;
 	DDRB = 1<<5;
@@ -1714,6 +1921,7 @@ int main(void)
 	 */
 	DDRC=1;
 	PORTC=0xff;
+#endif
 
 	// configure external interrupt 0 to trigger on rising edge
 #ifdef AT168_COMPATIBLE
@@ -1742,9 +1950,19 @@ int main(void)
 	if (GC_GET_B(gc_report)) {
 		cur_mapping = MAPPING_LOWER_THRESHOLD;
 	}
+	if (GC_GET_X(gc_report)) {
+		g_raw_mode = 1;
+	}
+	if (GC_GET_Y(gc_report)) {
+		g_tap_mode = 1;
+	}
+	tapReset();
+	rawUpdate();
+	nesPublish();
 
 
 	sync_init();
+	gcn64_setRetryHook(sync_may_retry);
 
 	sei();
 
@@ -1757,20 +1975,54 @@ int main(void)
 //			DEBUG_LOW();
 		}
 
-		if (sync_may_poll() || (reuse == 0xff)) {	
+		if (g_tap_mode && tap_frame != sync_frame()) {
+			// The console started reading what was captured. Keep
+			// only what is still pressed, once it is done.
+			tap_frame = sync_frame();
+			tapReset();
+			publish_pending = 1;
+		}
+
+		if (publish_pending) {
+			if (nesPublish()) {
+				publish_pending = 0;
+			}
+		}
+
+		// Extra polls also help finding when a wireless receiver gets
+		// its packets.
+		if (g_tap_mode || gamecubeGetKind() == GC_KIND_WIRELESS) {
+			may_sample = sync_may_sample();
+		} else {
+			may_sample = 0;
+		}
+
+		if (sync_may_poll() || sync_may_steal() || may_sample || (reuse == 0xff)) {	
 
 //			DEBUG_HIGH();
+			sync_poll_begin(gamecubeNeedsId());
 			gcpad->update();
 //			DEBUG_LOW();
 
+			changed = gcpad->changed(0);
+			if (gamecubeGetKind() == GC_KIND_WIRELESS) {
+				sync_packet_poll(changed);
+			}
 
-			if (gcpad->changed(0)) {
+			if (changed) {
 				// Read the gamepad
 				gcpad->buildReport(gc_report, 0);
 				// prepare the controller data byte
 				doMapping();
+				rawUpdate();
+				if (g_tap_mode) {
+					tapCapture();
+				}
+				publish_pending = !nesPublish();
 			}
+			sync_poll_end(gamecubeGetKind());
 
+#ifndef NES_SERVE_SPI
 			// It does not matter if the data changed or not. What matters
 			// is that it is a fresh read.
 			if (reuse == 0xff) {
@@ -1782,8 +2034,8 @@ int main(void)
 #endif
 			}
 			reuse = 0;
+#endif
 		}
 	}
 }
-
-
+#endif // HOST_BUILD
@@ -0,0 +1,158 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* NES side latency check: runs the firmware with the read timings of
+ * the games measured in main.c (INT0_vect), with a simulated controller
+ * holding A and Start, and reports how long the data line takes to
+ * follow the latch and the clock. Every bit read once the controller is
+ * seen must match the buttons, or the timings mean nothing.
+ *
+ * Not run yet: this was only compiled against stub simavr headers. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "nesdrv.h"
+#include "gcdrv.h"
+
+/* Clock periods from the INT0_vect comments. Super Mario Bros. 3 reads
+ * twice per frame. The frames start up to 2ms late so the interrupt
+ * finds the main loop doing different things. */
+static const struct nes_timing games[] = {
+	{ "Super Mario Bros. 3",	13.0,  12.0, 6.0, 8, 2, 40.0, NES_NTSC_FRAME_US, 2000.0 },
+	{ "Super Mario Bros. 2",	24.0,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "Super Mario Bros.",		15.8,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "Metroid",				15.8,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "Life Force",				24.0,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "Karnov",					19.4,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "TMNT",					25.2,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ "Zelda II",				15.2,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 2000.0 },
+	{ }
+};
+
+/* The firmware waits 500ms at power up, then detects the controller.
+ * The reads are checked from CHECK_US. */
+#define BOOT_US		600000.0
+#define CHECK_US	700000.0
+
+/* Status byte 0 (see gamecubeUpdate), and the NES byte it gives: A then
+ * Start are read first and fourth, low when pressed. */
+#define GC_BTN_A		0x01
+#define GC_BTN_START	0x10
+#define NES_EXPECTED	0x6f
+
+struct check {
+	avr_cycle_count_t from;
+	unsigned long bits, errors;
+};
+
+static void onBit(struct nesdrv *d, int read, int bit, int level,
+					avr_cycle_count_t written, avr_cycle_count_t when)
+{
+	struct check *c = d->param;
+	int expected = (NES_EXPECTED >> (7 - bit)) & 1;
+
+	if (when < c->from)
+		return;
+
+	c->bits++;
+	if (level != expected) {
+		if (!c->errors) {
+			printf("  read %d, bit %d at %.3fms: %d, expected %d\n", read, bit,
+					sim_toUs(d->s, when) / 1000.0, level, expected);
+		}
+		c->errors++;
+	}
+}
+
+static void usage(void)
+{
+	printf("Usage: bench [-f freq] [-n frames] mcu elf\n");
+	printf("   mcu: atmega8 or atmega168\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct sim s;
+	struct nesdrv d;
+	struct gcdrv g;
+	struct check c;
+	uint32_t freq = 0;
+	unsigned long frames = 300;
+	avr_cycle_count_t end;
+	int opt, i, res = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'n': frames = strtoul(optarg, NULL, 0); break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+
+	printf("%s, %s at %luHz, %lu frames per game\n", argv[optind + 1],
+			argv[optind], (unsigned long)freq, frames);
+
+	for (i=0; games[i].name; i++) {
+		srand(i + 1);
+
+		if (sim_load(&s, argv[optind + 1], argv[optind], freq))
+			return 1;
+
+		gcdrv_init(&g, &s);
+		g.status[0] = GC_BTN_A | GC_BTN_START;
+
+		c.from = sim_us(&s, CHECK_US);
+		c.bits = 0;
+		c.errors = 0;
+		nesdrv_init(&d, &s, &games[i]);
+		d.onBit = onBit;
+		d.param = &c;
+		nesdrv_start(&d, sim_us(&s, BOOT_US), frames);
+
+		end = sim_us(&s, BOOT_US + (frames + 1) * (games[i].frame_us + games[i].jitter_us));
+		if (sim_runUntil(&s, end)) {
+			res = 1;
+		}
+
+		printf("\n%s (clock period %.1fus)\n", games[i].name, games[i].clock_us);
+		sim_histPrint(&s, &d.latch_to_bit);
+		sim_histPrint(&s, &d.clock_to_bit);
+
+		if (!c.bits || c.errors) {
+			printf("  %lu of %lu bits wrong\n", c.errors, c.bits);
+			res = 1;
+		}
+		if (d.latch_to_bit.count != frames * games[i].reads) {
+			printf("  the first bit was not written after %lu latches\n",
+					frames * games[i].reads - d.latch_to_bit.count);
+			res = 1;
+		}
+
+		avr_terminate(s.avr);
+	}
+
+	return res;
+}
@@ -0,0 +1,138 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Power-up read check: the firmware reads the controller once at power
+ * up to choose its options (see main()). With X held, it must serve the
+ * raw report: the second byte read is the joystick X axis, 0x80 when
+ * centered. With nothing held, the line stays low after the 8th bit.
+ * This fails if the power-up read does not work, as it did on the
+ * GC_RX_ICP build while Timer1 was not started yet. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "nesdrv.h"
+#include "gcdrv.h"
+
+/* The firmware waits 500ms at power up */
+#define BOOT_US		600000.0
+#define FRAMES		10
+
+/* Status byte 0 (see gamecubeUpdate) */
+#define GC_BTN_X	0x04
+
+static const struct nes_timing reading = {
+	"16 bits per read", 15.8, 12.0, 6.0, 16, 1, 0.0, NES_NTSC_FRAME_US, 0.0
+};
+
+/* The levels of bits 8 to 15: raw bits are sent low when 1 */
+static const struct {
+	const char *name;
+	unsigned char buttons;
+	unsigned char levels;
+} cases[] = {
+	{ "nothing held", 0x00, 0x00 },
+	{ "X held (raw mode)", GC_BTN_X, (unsigned char)~0x80 },
+	{ }
+};
+
+struct check {
+	unsigned char levels;
+	unsigned long reads, errors;
+};
+
+static void onBit(struct nesdrv *d, int read, int bit, int level,
+					avr_cycle_count_t written, avr_cycle_count_t when)
+{
+	struct check *c = d->param;
+	int expected;
+
+	if (bit < 8)
+		return;
+
+	expected = (c->levels >> (15 - bit)) & 1;
+	if (level != expected)
+		c->errors++;
+	if (bit == 15)
+		c->reads++;
+}
+
+static void usage(void)
+{
+	printf("Usage: bootcheck [-f freq] [-i] mcu elf\n");
+	printf("   mcu: atmega8 or atmega168\n");
+	printf("   -i: GC_RX_ICP build, the controller is on PB0\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct sim s;
+	struct nesdrv d;
+	struct gcdrv g;
+	struct check c;
+	uint32_t freq = 0;
+	int opt, i, icp = 0, res = 0;
+
+	while ((opt = getopt(argc, argv, "f:ih")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'i': icp = 1; break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+
+	printf("%s, %s at %luHz\n", argv[optind + 1], argv[optind], (unsigned long)freq);
+
+	for (i=0; cases[i].name; i++) {
+		if (sim_load(&s, argv[optind + 1], argv[optind], freq))
+			return 1;
+
+		if (icp) {
+			gcdrv_initOn(&g, &s, 'B', 0);
+		} else {
+			gcdrv_init(&g, &s);
+		}
+		g.status[0] = cases[i].buttons;
+
+		c.levels = cases[i].levels;
+		c.reads = 0;
+		c.errors = 0;
+		nesdrv_init(&d, &s, &reading);
+		d.onBit = onBit;
+		d.param = &c;
+		nesdrv_start(&d, sim_us(&s, BOOT_US), FRAMES);
+
+		if (sim_runUntil(&s, sim_us(&s, BOOT_US + (FRAMES + 1) * reading.frame_us)))
+			res = 1;
+
+		printf("  %-20s %lu reads, %lu wrong bits\n", cases[i].name, c.reads, c.errors);
+		if (c.reads != FRAMES || c.errors)
+			res = 1;
+
+		avr_terminate(s.avr);
+	}
+
+	return res;
+}
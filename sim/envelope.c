@@ -0,0 +1,283 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Controller timing envelope: for each of the known controller
+ * identities, changes one parameter of the replies of the simulated
+ * controller (gcdrv.h) at a time, away from the nominal timing in both
+ * directions, until the firmware no longer receives the replies with the
+ * right number of bits. Reports the range where all of them were.
+ *
+ * Each value is kept for a number of replies (-n). The range is first
+ * scanned in coarse steps, then in fine steps (-r) past the last value
+ * which worked. No NES is connected, so transactions are never
+ * interrupted.
+ *
+ * The firmware only sends get id and the gamecube poll. The N64 and
+ * keyboard identities do not answer that poll, so only their get id
+ * replies are measured. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "gcdrv.h"
+
+/* The firmware waits 500ms at power up */
+#define BOOT_US			500000.0
+
+/* Simulated time per call to sim_runUntil, and before giving up on a
+ * sweep. */
+#define RUN_SLICE_US	10000.0
+#define RUN_MAX_US		120000000.0
+
+#define COARSE_STEPS	8
+
+static const struct {
+	unsigned char id[3];
+	const char *name;
+} pads[] = {
+	{ { 0x09, 0x00, 0x20 }, "gamecube controller" },
+	{ { 0xE9, 0xA0, 0x17 }, "Wavebird, controller on" },
+	{ { 0xA8, 0x00, 0x00 }, "Wavebird, controller off" },
+	{ { 0x05, 0x00, 0x01 }, "N64 controller, with pack (GETID only)" },
+	{ { 0x08, 0x20, 0x00 }, "ASCII keyboard (GETID only)" },
+	{ }
+};
+
+/* Fine step (-r) multiplier. The bit length is not in us. */
+static const double res_scale[GCDRV_PARAMS] = {
+	[GCDRV_SHORT ... GCDRV_GAP] = 1,
+	[GCDRV_SCALE] = 0.125,
+};
+
+struct sweep {
+	struct gcdrv g;
+	int param;
+	double nominal;
+	double value, step, res;
+	double last_ok;
+	int dir;			// 2: nominal, -1: down, 1: up, 0: done
+	int fine;
+	unsigned long per_value, judged;
+	double limit[2];	// down, up
+	int at_limit[2];	// never failed
+	int nominal_failed;
+};
+
+static void applyValue(struct sweep *w)
+{
+	w->g.timing = gcdrv_default_timing;
+	gcdrv_setParam(&w->g.timing, w->param, w->value);
+
+	/* Replies sent from now on are judged for this value */
+	w->g.tag++;
+	w->judged = 0;
+}
+
+/* Start the direction 'dir' from the nominal value, or finish. */
+static void startDirection(struct sweep *w, int dir)
+{
+	const struct gcdrv_param *p = &gcdrv_params[w->param];
+
+	w->dir = dir;
+	w->fine = 0;
+	w->last_ok = w->nominal;
+	w->step = w->res * COARSE_STEPS;
+	w->value = w->nominal + dir * w->step;
+
+	if (dir == 0) {
+		w->value = w->nominal;
+	} else if ((dir < 0 && w->value < p->min) || (dir > 0 && w->value > p->max)) {
+		w->value = dir < 0 ? p->min : p->max;
+		if (w->value == w->nominal) {
+			w->limit[dir > 0] = w->nominal;
+			w->at_limit[dir > 0] = 1;
+			startDirection(w, dir < 0 ? 1 : 0);
+			return;
+		}
+	}
+
+	applyValue(w);
+}
+
+static void nextValue(struct sweep *w, int ok)
+{
+	const struct gcdrv_param *p = &gcdrv_params[w->param];
+	int up = w->dir > 0;
+	double next;
+
+	if (ok) {
+		w->last_ok = w->value;
+		if (w->value == (up ? p->max : p->min)) {
+			w->limit[up] = w->value;
+			w->at_limit[up] = 1;
+			startDirection(w, up ? 0 : 1);
+			return;
+		}
+	} else if (!w->fine && w->step > w->res) {
+		/* Back to the last value which worked, in fine steps */
+		w->fine = 1;
+		w->step = w->res;
+	} else {
+		w->limit[up] = w->last_ok;
+		startDirection(w, up ? 0 : 1);
+		return;
+	}
+
+	next = w->last_ok + w->dir * w->step;
+	if (next < p->min)
+		next = p->min;
+	if (next > p->max)
+		next = p->max;
+	w->value = next;
+	applyValue(w);
+}
+
+static void onResult(struct gcdrv *g, unsigned char cmd, int tag, int ok)
+{
+	struct sweep *w = g->param;
+
+	if (tag != g->tag || !w->dir)
+		return;
+
+	w->judged++;
+	if (w->dir == 2) {
+		if (!ok) {
+			w->nominal_failed = 1;
+			w->dir = 0;
+		} else if (w->judged >= w->per_value) {
+			startDirection(w, -1);
+		}
+		return;
+	}
+
+	if (!ok) {
+		nextValue(w, 0);
+	} else if (w->judged >= w->per_value) {
+		nextValue(w, 1);
+	}
+}
+
+/* Returns 0 if the sweep completed */
+static int runSweep(struct sweep *w, const char *elf, const char *mcu, uint32_t freq,
+					const unsigned char *id, int param, double res, unsigned long per_value)
+{
+	struct sim s;
+	avr_cycle_count_t t;
+	int res_run = 0;
+
+	if (sim_load(&s, elf, mcu, freq))
+		return -1;
+
+	memset(w, 0, sizeof(struct sweep));
+	gcdrv_init(&w->g, &s);
+	memcpy(w->g.id, id, sizeof(w->g.id));
+	w->g.onResult = onResult;
+	w->g.param = w;
+	w->param = param;
+	w->nominal = gcdrv_nominal(param);
+	w->res = res * res_scale[param];
+	w->per_value = per_value;
+
+	/* The nominal value first. The sweep does not start if it fails. */
+	w->value = w->nominal;
+	w->dir = 2;
+	applyValue(w);
+
+	for (t = sim_us(&s, BOOT_US); w->dir; t += sim_us(&s, RUN_SLICE_US)) {
+		if (t > sim_us(&s, RUN_MAX_US) || sim_runUntil(&s, t)) {
+			res_run = -1;
+			break;
+		}
+	}
+
+	avr_terminate(s.avr);
+	return res_run;
+}
+
+static void usage(void)
+{
+	printf("Usage: envelope [-f freq] [-n replies] [-r resolution] [-i id] mcu elf\n");
+	printf("   mcu: atmega8 or atmega168\n");
+	printf("   -n: replies per value (default 16)\n");
+	printf("   -r: fine step in us (default 0.0625)\n");
+	printf("   -i: only this identity (hex, e.g. 090020)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct sweep w;
+	uint32_t freq = 0;
+	unsigned long per_value = 16, only = 0;
+	double res = 0.0625;
+	unsigned long id;
+	int opt, i, p, failed = 0, filter = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:r:i:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'n': per_value = strtoul(optarg, NULL, 0); break;
+			case 'r': res = atof(optarg); break;
+			case 'i': only = strtoul(optarg, NULL, 16); filter = 1; break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2 || per_value < 1 || res <= 0) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+
+	printf("%s, %s at %luHz, %lu replies per value\n", argv[optind + 1],
+			argv[optind], (unsigned long)freq, per_value);
+
+	for (i=0; pads[i].name; i++) {
+		id = (pads[i].id[0] << 16) | (pads[i].id[1] << 8) | pads[i].id[2];
+		if (filter && id != only)
+			continue;
+
+		printf("\n%06lx %s\n", id, pads[i].name);
+		printf("  %-12s %9s %21s\n", "", "nominal", "works from ... to");
+
+		for (p=0; p<GCDRV_PARAMS; p++) {
+			srand(p + 1);
+			if (runSweep(&w, argv[optind + 1], argv[optind], freq, pads[i].id, p, res, per_value)) {
+				printf("  %-12s did not complete\n", gcdrv_params[p].name);
+				failed = 1;
+				continue;
+			}
+			if (w.nominal_failed) {
+				printf("  %-12s fails at the nominal value\n", gcdrv_params[p].name);
+				failed = 1;
+				continue;
+			}
+			printf("  %-12s %7.4f%-2s %s%7.4f ... %s%7.4f\n", gcdrv_params[p].name,
+					w.nominal, gcdrv_params[p].unit,
+					w.at_limit[0] ? "<=" : "  ", w.limit[0],
+					w.at_limit[1] ? ">=" : "  ", w.limit[1]);
+		}
+
+		printf("  firmware command bits, low level: 0 %.3f-%.3fus, 1 %.3f-%.3fus\n",
+				w.g.cmd_low_min[0] * 1e6 / freq, w.g.cmd_low_max[0] * 1e6 / freq,
+				w.g.cmd_low_min[1] * 1e6 / freq, w.g.cmd_low_max[1] * 1e6 / freq);
+	}
+
+	return failed;
+}
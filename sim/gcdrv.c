@@ -0,0 +1,342 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcdrv.h"
+
+/* Default build. GC_RX_ICP moves the line to PB0. */
+#define GC_PORT		'C'
+#define GC_PIN		5
+
+/* The firmware sends 1us / 3us bits */
+#define CMD_THRESHOLD_US	2.0
+
+/* A low level starting this long after the previous one starts a new
+ * command. */
+#define IDLE_US			20.0
+
+/* As in gamecube.c */
+#define GC_ID_KEEPALIVE	128
+
+/* struct gcn64_stats (gcn64_protocol.h) starts with the number of
+ * preempted transactions, a 16 bit unsigned int. */
+#define STATS_VARIABLE	"gcn64_stats"
+#define STATS_PREEMPTED	0
+
+/* gc_state in gamecube.c, a byte: GC_STATE_READY unless the last
+ * transaction with the controller failed. */
+#define STATE_VARIABLE	"gc_state"
+#define GC_STATE_READY	1
+
+const struct gcdrv_timing gcdrv_default_timing = {
+	.short_us = 1.0,
+	.long_us = 3.0,
+	.stop_us = 1.0,
+	.delay_us = 3.0,
+	.jitter_us = 0,
+	.gap_us = 0,
+};
+
+const struct gcdrv_param gcdrv_params[GCDRV_PARAMS] = {
+	[GCDRV_SHORT] = { "short", "short level", "us", 0.0625, 8.0, 0.25, 2.5 },
+	[GCDRV_LONG] = { "long", "long level", "us", 0.0625, 12.0, 1.0, 7.0 },
+	[GCDRV_SCALE] = { "scale", "bit length", "x", 0.125, 4.0, 0.5, 2.5 },
+	[GCDRV_STOP] = { "stop", "stop bit", "us", 0.0625, 12.0, 0.25, 8.0 },
+	[GCDRV_DELAY] = { "delay", "reply delay", "us", 0.0625, 200.0, 0.5, 80.0 },
+	[GCDRV_JITTER] = { "jitter", "jitter", "us", 0.0, 4.0, 0.0, 1.0 },
+	[GCDRV_GAP] = { "gap", "bit gap", "us", 0.0, 12.0, 0.0, 6.0 },
+};
+
+int gcdrv_findParam(const char *key)
+{
+	int i;
+
+	for (i=0; i<GCDRV_PARAMS; i++) {
+		if (!strcmp(key, gcdrv_params[i].key))
+			return i;
+	}
+	return -1;
+}
+
+double gcdrv_nominal(int param)
+{
+	const struct gcdrv_timing *t = &gcdrv_default_timing;
+
+	switch (param)
+	{
+		case GCDRV_SHORT: return t->short_us;
+		case GCDRV_LONG: return t->long_us;
+		case GCDRV_SCALE: return 1.0;
+		case GCDRV_STOP: return t->stop_us;
+		case GCDRV_DELAY: return t->delay_us;
+		case GCDRV_JITTER: return t->jitter_us;
+		case GCDRV_GAP: return t->gap_us;
+	}
+	return 0;
+}
+
+void gcdrv_setParam(struct gcdrv_timing *t, int param, double value)
+{
+	const struct gcdrv_timing *d = &gcdrv_default_timing;
+
+	switch (param)
+	{
+		case GCDRV_SHORT: t->short_us = value; break;
+		case GCDRV_LONG: t->long_us = value; break;
+		case GCDRV_SCALE:
+			t->short_us = d->short_us * value;
+			t->long_us = d->long_us * value;
+			t->stop_us = d->stop_us * value;
+			break;
+		case GCDRV_STOP: t->stop_us = value; break;
+		case GCDRV_DELAY: t->delay_us = value; break;
+		case GCDRV_JITTER: t->jitter_us = value; break;
+		case GCDRV_GAP: t->gap_us = value; break;
+	}
+}
+
+static avr_cycle_count_t gcdrv_edge(struct avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct gcdrv *g = param;
+
+	sim_setPin(g->s, g->port, g->pin, g->edge & 1);
+	if (++g->edge >= g->n_edges)
+		return 0;
+
+	return g->edges[g->edge];
+}
+
+/* A level of 'us' microseconds, give or take the jitter. Never shorter
+ * than a cycle. */
+static avr_cycle_count_t gcdrv_level(struct gcdrv *g, double us)
+{
+	double j = g->timing.jitter_us;
+
+	if (j > 0)
+		us += j * (2.0 * rand() / (RAND_MAX + 1.0) - 1.0);
+	if (us < 0)
+		us = 0;
+
+	return sim_us(g->s, us) ? sim_us(g->s, us) : 1;
+}
+
+static void gcdrv_reply(struct gcdrv *g, const unsigned char *data, int n_bytes)
+{
+	const struct gcdrv_timing *tm = &g->timing;
+	struct sim *s = g->s;
+	avr_cycle_count_t t = g->rose + gcdrv_level(g, tm->delay_us);
+	int i, one;
+
+	g->n_edges = 0;
+	for (i=0; i<n_bytes * 8; i++) {
+		one = data[i >> 3] & (0x80 >> (i & 7));
+		g->edges[g->n_edges++] = t;
+		t += gcdrv_level(g, one ? tm->short_us : tm->long_us);
+		g->edges[g->n_edges++] = t;
+		t += gcdrv_level(g, (one ? tm->long_us : tm->short_us) + tm->gap_us);
+	}
+
+	// stop bit
+	g->edges[g->n_edges++] = t;
+	g->edges[g->n_edges++] = t + gcdrv_level(g, tm->stop_us);
+
+	g->edge = 0;
+	g->reply_start = g->edges[0];
+	g->replies++;
+	avr_cycle_timer_register(s->avr, g->edges[0] - s->avr->cycle, gcdrv_edge, g);
+}
+
+static int gcdrv_commandLength(unsigned char c)
+{
+	switch (c)
+	{
+		case 0x40: case 0x42: case 0x43: case 0x54:
+			return 3;
+	}
+	return 1;
+}
+
+static uint16_t gcdrv_preempted(struct gcdrv *g)
+{
+	return g->stats ? sim_read16(g->s, g->stats + STATS_PREEMPTED) : 0;
+}
+
+/* The previous reply worked if the firmware did not discard it and sends
+ * what follows a success. A get id after a poll is a keep-alive if the
+ * firmware still takes the controller as ready. Without gc_state in the
+ * ELF, only the get id sent exactly GC_ID_KEEPALIVE polls after the last
+ * one is: a transaction counts once, however many times it is retried. */
+static void gcdrv_judge(struct gcdrv *g, unsigned char next)
+{
+	int ok;
+
+	if (g->pending_cmd < 0)
+		return;
+
+	if (gcdrv_preempted(g) != g->pending_preempted) {
+		g->discarded++;
+		ok = 0;
+	} else if (g->pending_cmd == 0x40) {
+		g->polls_since_id++;
+		if (next == 0x40) {
+			ok = 1;
+		} else if (next != 0x00) {
+			ok = 0;
+		} else if (g->state) {
+			ok = g->s->avr->data[g->state] == GC_STATE_READY;
+		} else {
+			ok = g->polls_since_id == GC_ID_KEEPALIVE;
+		}
+	} else if (g->pending_cmd == 0x00) {
+		g->polls_since_id = 0;
+		ok = next != 0x00;
+	} else {
+		ok = 1; // never sent by the firmware
+	}
+
+	if (g->onResult)
+		g->onResult(g, g->pending_cmd, g->pending_tag, ok);
+	g->pending_cmd = -1;
+}
+
+static void gcdrv_command(struct gcdrv *g)
+{
+	unsigned char type = g->id[0] & 0x0f;
+	int keyboard = g->id[0] == 0x08 && g->id[1] == 0x20;
+
+	g->commands++;
+	gcdrv_judge(g, g->cmd[0]);
+
+	switch (g->cmd[0])
+	{
+		case 0x00:
+			gcdrv_reply(g, g->id, sizeof(g->id));
+			break;
+
+		case 0x01:
+			if (type != 0x05)
+				goto unknown;
+			gcdrv_reply(g, g->status, 4);
+			break;
+
+		case 0x40:
+			if (keyboard || (type != 0x08 && type != 0x09 && type != 0x0b))
+				goto unknown;
+			gcdrv_reply(g, g->status, sizeof(g->status));
+			break;
+
+		case 0x54:
+			if (!keyboard)
+				goto unknown;
+			gcdrv_reply(g, g->status, sizeof(g->status));
+			break;
+
+		default:
+			goto unknown;
+	}
+
+	g->pending_cmd = g->cmd[0];
+	g->pending_tag = g->tag;
+	g->pending_preempted = gcdrv_preempted(g);
+	return;
+
+unknown:
+	g->unknown++;
+}
+
+static void gcdrv_ddrWrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+	struct gcdrv *g = param;
+	int low = (v >> g->pin) & 1;
+	int one;
+
+	if (low == g->low)
+		return;
+	g->low = low;
+
+	if (low) {
+		if (avr->cycle - g->rose > sim_us(g->s, IDLE_US)) {
+			g->bits = 0;
+			g->cmd_bits = 8;
+		}
+		g->fell = avr->cycle;
+		return;
+	}
+
+	/* The line is released. The port module may have updated the pin
+	 * from the output value. */
+	g->rose = avr->cycle;
+	sim_setPin(g->s, g->port, g->pin, 1);
+
+	if (g->bits == g->cmd_bits) {
+		// stop bit
+		gcdrv_command(g);
+		g->bits = 0;
+		g->cmd_bits = 8;
+		return;
+	}
+
+	one = g->rose - g->fell < sim_us(g->s, CMD_THRESHOLD_US);
+	if (g->rose - g->fell < g->cmd_low_min[one])
+		g->cmd_low_min[one] = g->rose - g->fell;
+	if (g->rose - g->fell > g->cmd_low_max[one])
+		g->cmd_low_max[one] = g->rose - g->fell;
+	if (one) {
+		g->cmd[g->bits >> 3] |= 0x80 >> (g->bits & 7);
+	} else {
+		g->cmd[g->bits >> 3] &= ~(0x80 >> (g->bits & 7));
+	}
+	g->bits++;
+
+	if (g->bits == 8)
+		g->cmd_bits = gcdrv_commandLength(g->cmd[0]) * 8;
+}
+
+void gcdrv_initOn(struct gcdrv *g, struct sim *s, char port, int pin)
+{
+	static const unsigned char id[3] = { 0x09, 0x00, 0x20 };
+
+	memset(g, 0, sizeof(struct gcdrv));
+	g->s = s;
+	g->port = port;
+	g->pin = pin;
+	memcpy(g->id, id, sizeof(id));
+	g->status[1] = 0x80;
+	memset(g->status + 2, 0x80, 4);
+	g->status[6] = 0x20;
+	g->status[7] = 0x20;
+	g->timing = gcdrv_default_timing;
+	g->cmd_bits = 8;
+	g->pending_cmd = -1;
+	g->cmd_low_min[0] = g->cmd_low_min[1] = ~(avr_cycle_count_t)0;
+
+	g->stats = sim_findVariable(s, STATS_VARIABLE);
+	if (!g->stats) {
+		fprintf(stderr, "%s: no %s, retried transactions are taken as successes\n",
+				s->elf, STATS_VARIABLE);
+	}
+	g->state = sim_findVariable(s, STATE_VARIABLE);
+
+	sim_setPin(s, port, pin, 1);
+	sim_watchWrite(s, port == 'B' ? s->ports.ddrb : s->ports.ddrc, gcdrv_ddrWrite, g);
+}
+
+void gcdrv_init(struct gcdrv *g, struct sim *s)
+{
+	gcdrv_initOn(g, s, GC_PORT, GC_PIN);
+}
@@ -0,0 +1,120 @@
+#ifndef _gcdrv_h__
+#define _gcdrv_h__
+
+/* Simulated gamecube/N64 controller on the data line of the default
+ * build (PC5), or of the GC_RX_ICP build (PB0). Commands are decoded
+ * from the writes of DDRC or DDRB (the firmware pulls the line low by
+ * making the pin an output) and answered by driving the pin, according
+ * to the identity:
+ *
+ *   all                    0x00 (get id): the 3 bytes of 'id'
+ *   0x?8????, 0x?9????,    0x40 0x03 0x0X (poll): the 8 bytes of 'status'
+ *   0x?b???? (gamecube)
+ *   0x?5???? (N64)         0x01 (get status): the first 4 bytes of 'status'
+ *   0x0820?? (keyboard)    0x54 0x00 0x00 (poll): the 8 bytes of 'status'
+ *
+ * as gcn64_detectController() classifies them. This firmware only sends
+ * get id and the gamecube poll.
+ *
+ * By default, bits are 4us long: 0 is 3us low and 1us high, 1 is 1us low
+ * and 3us high. The stop bit is 1us low. The reply starts 3us after the
+ * stop bit of the command. See struct gcdrv_timing.
+ */
+
+#include "simcommon.h"
+
+#define GCDRV_MAX_CMD		3
+#define GCDRV_MAX_REPLY		8	// bytes
+
+struct gcdrv_timing {
+	double short_us;	// low level of 1, high level of 0
+	double long_us;		// high level of 1, low level of 0
+	double stop_us;		// low level of the stop bit
+	double delay_us;	// from the end of the command to the reply
+	double jitter_us;	// each level is up to this much shorter or longer
+	double gap_us;		// added to the high level of each data bit
+};
+
+/* The parameters of struct gcdrv_timing, for the tools which vary them.
+ * GCDRV_SCALE multiplies the default bit levels and stop bit. */
+#define GCDRV_SHORT		0
+#define GCDRV_LONG		1
+#define GCDRV_SCALE		2
+#define GCDRV_STOP		3
+#define GCDRV_DELAY		4
+#define GCDRV_JITTER	5
+#define GCDRV_GAP		6
+#define GCDRV_PARAMS	7
+
+struct gcdrv_param {
+	const char *key;	// for command lines
+	const char *name;
+	const char *unit;
+	double min, max;	// never tried past these
+	double lo, hi;		// usual range to explore
+};
+
+extern const struct gcdrv_param gcdrv_params[GCDRV_PARAMS];
+
+/* Returns the parameter, or -1 */
+int gcdrv_findParam(const char *key);
+double gcdrv_nominal(int param);
+void gcdrv_setParam(struct gcdrv_timing *t, int param, double value);
+
+struct gcdrv {
+	struct sim *s;
+
+	unsigned char id[3];
+	unsigned char status[GCDRV_MAX_REPLY];
+	struct gcdrv_timing timing;
+
+	/* Called when the firmware shows whether the reply to a command was
+	 * received with the right number of bits, which is when it sends the
+	 * next command: after a get id, a poll follows only if the get id
+	 * succeeded. After a poll, a get id follows only on failure or as a
+	 * keep-alive (GC_ID_KEEPALIVE in gamecube.c), told apart by the
+	 * gc_state of the firmware when its ELF has it. A reply the firmware
+	 * discarded because an interrupt preempted the transaction is a
+	 * failure even if the same command follows (a retry): this is read
+	 * from the gcn64_stats counters of the firmware, when its ELF has
+	 * them. 'tag' is the value of the field below when the reply was
+	 * sent. */
+	void (*onResult)(struct gcdrv *g, unsigned char cmd, int tag, int ok);
+	void *param;
+	int tag;
+
+	unsigned long commands;	// complete commands
+	unsigned long replies;
+	unsigned long unknown;	// commands not answered
+	unsigned long discarded;	// replies the firmware discarded (preempted)
+
+	/* Low level of the bits sent by the firmware, by value */
+	avr_cycle_count_t cmd_low_min[2], cmd_low_max[2];
+
+	/* internal */
+	char port;
+	int pin;
+	int low;
+	avr_cycle_count_t fell, rose;
+	int bits, cmd_bits;
+	unsigned char cmd[GCDRV_MAX_CMD];
+	avr_cycle_count_t edges[(GCDRV_MAX_REPLY * 8 + 1) * 2];
+	int n_edges, edge;
+	avr_cycle_count_t reply_start;
+	int pending_cmd, pending_tag;
+	int polls_since_id;
+	avr_io_addr_t stats;	// gcn64_stats in the firmware, 0 if unknown
+	uint16_t pending_preempted;
+	avr_io_addr_t state;	// gc_state in the firmware, 0 if unknown
+};
+
+/* A standard controller (0x090020) with the sticks centered and no
+ * button pressed, with the default timing. */
+void gcdrv_init(struct gcdrv *g, struct sim *s);
+
+/* The same on another pin of port B or C: 'B', 0 for GC_RX_ICP. */
+void gcdrv_initOn(struct gcdrv *g, struct sim *s, char port, int pin);
+
+extern const struct gcdrv_timing gcdrv_default_timing;
+
+#endif // _gcdrv_h__
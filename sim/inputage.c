@@ -0,0 +1,253 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Input age benchmark: presses and releases A on the simulated
+ * controller (gcdrv.h) at random times while a simulated console
+ * (nesdrv.h) reads the firmware at a steady frame rate. The input age is
+ * the time from the change to the first latch of the frame whose reads
+ * have it: when a game reads several times per frame (a burst), it is
+ * taken from the first read of the burst, not from the read which first
+ * shows the change.
+ *
+ * Several firmwares (e.g. built with and without OLD_MODE) can be given
+ * to compare them on the same changes: the random sequence is the same
+ * for all of them.
+ *
+ * Not run yet: this was only compiled against stub simavr headers. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "nesdrv.h"
+#include "gcdrv.h"
+
+/* The firmware waits 500ms at power up. Then the frame period is
+ * learned by the adaptive scheduler. */
+#define BOOT_US			600000.0
+#define WARMUP_US		1000000.0
+
+/* Status byte 0, bit 0: A (see gamecubeUpdate) */
+#define GC_BTN_A		0x01
+
+static const struct nes_timing cadences[] = {
+	{ "NTSC, one read",			15.8,  12.0, 6.0, 8, 1, 0.0,  NES_NTSC_FRAME_US, 0.0 },
+	{ "PAL, one read",			15.8,  12.0, 6.0, 8, 1, 0.0,  NES_PAL_FRAME_US, 0.0 },
+	{ "NTSC, two reads (SMB3)",	13.0,  12.0, 6.0, 8, 2, 40.0, NES_NTSC_FRAME_US, 0.0 },
+	{ }
+};
+
+struct age {
+	struct sim s;
+	struct nesdrv d;
+	struct gcdrv g;
+
+	unsigned long n_changes;
+	int pressed;			// state sent by the controller
+	int pending;			// not yet seen by the console
+	avr_cycle_count_t changed, latch;
+
+	double *ages;			// in us
+	unsigned long n_ages;
+	struct sim_hist hist;
+};
+
+static double randomIn(double lo, double hi)
+{
+	return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+static avr_cycle_count_t change(struct avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct age *a = param;
+
+	a->pressed = !a->pressed;
+	if (a->pressed) {
+		a->g.status[0] |= GC_BTN_A;
+	} else {
+		a->g.status[0] &= ~GC_BTN_A;
+	}
+	a->pending = 1;
+	a->changed = when;
+
+	return 0;
+}
+
+static void onLatch(struct nesdrv *d, int read, avr_cycle_count_t when)
+{
+	struct age *a = d->param;
+
+	/* The first latch of the burst */
+	if (read == 0)
+		a->latch = when;
+}
+
+static void onBit(struct nesdrv *d, int read, int bit, int level,
+					avr_cycle_count_t written, avr_cycle_count_t when)
+{
+	struct age *a = d->param;
+	double frame_us = d->t.frame_us;
+
+	/* A is the first bit, low when pressed */
+	if (bit != 0 || !a->pending || a->latch < a->changed || level == a->pressed)
+		return;
+
+	a->pending = 0;
+	a->ages[a->n_ages++] = sim_toUs(&a->s, a->latch - a->changed);
+	sim_histAdd(&a->hist, a->latch - a->changed);
+
+	/* The next change, at a random phase of a later frame */
+	if (a->n_ages < a->n_changes) {
+		avr_cycle_timer_register(a->s.avr, sim_us(&a->s, randomIn(frame_us, 2 * frame_us)),
+									change, a);
+	}
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, unsigned long n, double p)
+{
+	unsigned long i = p * (n - 1) + 0.5;
+
+	return sorted[i];
+}
+
+static int runCadence(struct age *a, const char *mcu, const char *elf, uint32_t freq,
+						unsigned long id, const struct nes_timing *t, unsigned long n)
+{
+	avr_cycle_count_t end;
+	double sum = 0;
+	unsigned long i;
+
+	if (sim_load(&a->s, elf, mcu, freq))
+		return -1;
+
+	nesdrv_init(&a->d, &a->s, t);
+	a->d.onLatch = onLatch;
+	a->d.onBit = onBit;
+	a->d.param = a;
+	gcdrv_init(&a->g, &a->s);
+	a->g.id[0] = id >> 16;
+	a->g.id[1] = id >> 8;
+	a->g.id[2] = id;
+
+	a->n_changes = n;
+	a->n_ages = 0;
+	a->pressed = 0;
+	a->pending = 0;
+	a->latch = 0;
+	sim_histInit(&a->hist, "input age", sim_us(&a->s, 1000));
+
+	nesdrv_start(&a->d, sim_us(&a->s, BOOT_US), 0);
+	avr_cycle_timer_register(a->s.avr, sim_us(&a->s, BOOT_US + WARMUP_US +
+								randomIn(0, t->frame_us)), change, a);
+
+	/* Each change is seen within a few frames */
+	end = sim_us(&a->s, BOOT_US + WARMUP_US + (n + 1) * 8 * t->frame_us);
+	while (a->n_ages < n && a->s.avr->cycle < end) {
+		if (sim_runUntil(&a->s, a->s.avr->cycle + sim_us(&a->s, t->frame_us)))
+			break;
+	}
+	avr_terminate(a->s.avr);
+
+	if (a->n_ages < n) {
+		printf("  %-28s %lu of %lu changes seen\n", elf, a->n_ages, n);
+		return -1;
+	}
+
+	qsort(a->ages, a->n_ages, sizeof(double), cmpDouble);
+	for (i=0; i<a->n_ages; i++)
+		sum += a->ages[i];
+
+	printf("  %-28s %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f\n", elf,
+			a->ages[0] / 1000.0, percentile(a->ages, a->n_ages, 0.5) / 1000.0,
+			sum / a->n_ages / 1000.0, percentile(a->ages, a->n_ages, 0.95) / 1000.0,
+			percentile(a->ages, a->n_ages, 0.99) / 1000.0,
+			a->ages[a->n_ages - 1] / 1000.0);
+	if (a->g.discarded) {
+		printf("  %-28s %lu of %lu replies discarded by the firmware (preempted)\n", "",
+				a->g.discarded, a->g.replies);
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: inputage [-f freq] [-n changes] [-i id] [-s seed] [-v] mcu elf [elf...]\n");
+	printf("   mcu: atmega8 or atmega168\n");
+	printf("   -n: button changes per cadence (default 200)\n");
+	printf("   -i: controller identity, hex (default 090020)\n");
+	printf("   -v: print the histograms\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct age a;
+	uint32_t freq = 0;
+	unsigned long n = 200, id = 0x090020, seed = 1;
+	int opt, c, e, verbose = 0, res = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:i:s:vh")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'n': n = strtoul(optarg, NULL, 0); break;
+			case 'i': id = strtoul(optarg, NULL, 16); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'v': verbose = 1; break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind < 2 || n < 1) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+
+	a.ages = calloc(n, sizeof(double));
+	if (!a.ages)
+		return 1;
+
+	printf("%s at %luHz, id %06lx, %lu changes of A per cadence\n", argv[optind],
+			(unsigned long)freq, id, n);
+
+	for (c=0; cadences[c].name; c++) {
+		printf("\n%s (frame %.0fus)\n", cadences[c].name, cadences[c].frame_us);
+		printf("  %-28s %7s %7s %7s %7s %7s %7s (ms)\n", "",
+				"min", "median", "avg", "95%", "99%", "max");
+
+		for (e=optind + 1; e<argc; e++) {
+			srand(seed + c);
+			if (runCadence(&a, argv[optind], argv[e], freq, id, &cadences[c], n)) {
+				res = 1;
+				continue;
+			}
+			if (verbose)
+				sim_histPrint(&a.s, &a.hist);
+		}
+	}
+
+	return res;
+}
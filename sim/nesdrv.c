@@ -0,0 +1,149 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "nesdrv.h"
+
+#define NES_LATCH_PORT	'D'
+#define NES_LATCH_PIN	2
+#define NES_CLOCK_PORT	'C'
+#define NES_CLOCK_PIN	1
+#define NES_DATA_PIN	0
+
+#define ST_LATCH_HIGH	0
+#define ST_LATCH_LOW	1
+#define ST_CLOCK_LOW	2
+#define ST_CLOCK_HIGH	3
+
+static void nesdrv_dataWrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+	struct nesdrv *d = param;
+
+	d->level = (v >> NES_DATA_PIN) & 1;
+	d->written = avr->cycle;
+
+	if (d->wait_latch) {
+		sim_histAdd(&d->latch_to_bit, avr->cycle - d->edge);
+		d->wait_latch = 0;
+	}
+	if (d->wait_clock) {
+		sim_histAdd(&d->clock_to_bit, avr->cycle - d->edge);
+		d->wait_clock = 0;
+	}
+}
+
+void nesdrv_monitor(struct nesdrv *d, struct sim *s)
+{
+	d->s = s;
+	d->level = 1;
+	sim_histInit(&d->latch_to_bit, "latch to first bit", sim_us(s, 0.25));
+	sim_histInit(&d->clock_to_bit, "clock fall to next bit", sim_us(s, 0.125));
+	sim_watchWrite(s, s->ports.portc, nesdrv_dataWrite, d);
+}
+
+void nesdrv_init(struct nesdrv *d, struct sim *s, const struct nes_timing *t)
+{
+	memset(d, 0, sizeof(struct nesdrv));
+	d->t = *t;
+	nesdrv_monitor(d, s);
+
+	sim_setPin(s, NES_LATCH_PORT, NES_LATCH_PIN, 0);
+	sim_setPin(s, NES_CLOCK_PORT, NES_CLOCK_PIN, 1);
+}
+
+static avr_cycle_count_t nesdrv_jitter(struct nesdrv *d)
+{
+	if (d->t.jitter_us <= 0)
+		return 0;
+	return sim_us(d->s, d->t.jitter_us * (rand() / (RAND_MAX + 1.0)));
+}
+
+static avr_cycle_count_t nesdrv_edge(struct avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct nesdrv *d = param;
+	struct sim *s = d->s;
+
+	d->edge = when;
+
+	switch (d->state)
+	{
+		case ST_LATCH_HIGH:
+			sim_setPin(s, NES_LATCH_PORT, NES_LATCH_PIN, 1);
+			d->wait_latch = 1;
+			d->wait_clock = 0;
+			d->bit = 0;
+			if (d->onLatch)
+				d->onLatch(d, d->read, when);
+			d->state = ST_LATCH_LOW;
+			return when + sim_us(s, d->t.latch_us);
+
+		case ST_LATCH_LOW:
+			sim_setPin(s, NES_LATCH_PORT, NES_LATCH_PIN, 0);
+			d->state = ST_CLOCK_LOW;
+			return when + sim_us(s, d->t.first_clock_us);
+
+		case ST_CLOCK_LOW:
+			/* The console samples now, before the firmware can
+			 * react to the edge. */
+			if (d->onBit)
+				d->onBit(d, d->read, d->bit, d->level, d->written, when);
+			d->wait_latch = 0;
+			d->wait_clock = 1;
+			sim_setPin(s, NES_CLOCK_PORT, NES_CLOCK_PIN, 0);
+			d->state = ST_CLOCK_HIGH;
+			return when + sim_us(s, d->t.clock_us / 2);
+
+		case ST_CLOCK_HIGH:
+			sim_setPin(s, NES_CLOCK_PORT, NES_CLOCK_PIN, 1);
+			if (++d->bit < d->t.bits) {
+				d->state = ST_CLOCK_LOW;
+				return when + sim_us(s, d->t.clock_us / 2);
+			}
+
+			d->state = ST_LATCH_HIGH;
+			if (++d->read < d->t.reads) {
+				return when + sim_us(s, d->t.clock_us / 2 + d->t.read_gap_us);
+			}
+
+			d->read = 0;
+			d->frames++;
+			if (d->max_frames && d->frames >= d->max_frames)
+				return 0;
+
+			d->frame_start += sim_us(s, d->t.frame_us);
+			return d->frame_start + nesdrv_jitter(d);
+	}
+
+	return 0;
+}
+
+void nesdrv_start(struct nesdrv *d, avr_cycle_count_t start, unsigned long max_frames)
+{
+	d->max_frames = max_frames;
+	d->frames = 0;
+	d->read = 0;
+	d->state = ST_LATCH_HIGH;
+	d->frame_start = start;
+
+	avr_cycle_timer_register(d->s->avr, start + nesdrv_jitter(d) - d->s->avr->cycle,
+								nesdrv_edge, d);
+}
+
+int nesdrv_done(const struct nesdrv *d)
+{
+	return d->max_frames && d->frames >= d->max_frames;
+}
@@ -0,0 +1,68 @@
+#ifndef _nesdrv_h__
+#define _nesdrv_h__
+
+/* Simulated NES controller port: drives the latch and clock lines of the
+ * firmware like a console would and watches the data line.
+ *
+ * The console samples the data line when it pulls the clock low, so a
+ * bit must be out before the falling edge which reads it: the first bit
+ * before the first falling edge after the latch, the second before the
+ * second edge, etc. The firmware changes the data line right after each
+ * falling edge.
+ *
+ * Only the default (bit-banged) build is supported: latch on PD2 (INT0),
+ * clock on PC1, data on PC0.
+ */
+
+#include "simcommon.h"
+
+struct nes_timing {
+	const char *name;
+	double clock_us;		// clock period
+	double latch_us;		// latch pulse width
+	double first_clock_us;	// from the end of the latch to the first clock
+	int bits;				// clock pulses per read
+	int reads;				// reads per frame
+	double read_gap_us;		// from the end of a read to the next latch
+	double frame_us;
+	double jitter_us;		// random delay added to the start of each frame
+};
+
+#define NES_NTSC_FRAME_US	16639.0
+#define NES_PAL_FRAME_US	19997.0
+
+struct nesdrv {
+	struct sim *s;
+	struct nes_timing t;
+
+	/* Called at each latch (rising edge) and for each bit read. */
+	void (*onLatch)(struct nesdrv *d, int read, avr_cycle_count_t when);
+	void (*onBit)(struct nesdrv *d, int read, int bit, int level,
+				avr_cycle_count_t written, avr_cycle_count_t when);
+	void *param;
+
+	/* The data line */
+	int level;
+	avr_cycle_count_t written;	// last write of PORTC
+
+	/* Time from the rising edge of the latch to the first write of the
+	 * data line, and from each falling clock edge to the next write. */
+	struct sim_hist latch_to_bit;
+	struct sim_hist clock_to_bit;
+
+	/* internal */
+	int state, read, bit;
+	unsigned long frames, max_frames;
+	avr_cycle_count_t frame_start, edge;
+	int wait_latch, wait_clock;
+};
+
+/* Start driving frames at cycle 'start'. max_frames 0 means no limit. */
+void nesdrv_init(struct nesdrv *d, struct sim *s, const struct nes_timing *t);
+void nesdrv_start(struct nesdrv *d, avr_cycle_count_t start, unsigned long max_frames);
+int nesdrv_done(const struct nesdrv *d);
+
+/* For the tools driving the lines from a capture instead */
+void nesdrv_monitor(struct nesdrv *d, struct sim *s);
+
+#endif // _nesdrv_h__
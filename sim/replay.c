@@ -0,0 +1,529 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Trace replay: drives the latch and clock lines of the firmware as in a
+ * capture of a real console (see trace.h) and checks the bits it serves.
+ *
+ * If the capture has the NES data line, each read must match it bit for
+ * bit. The adapter which was on the console during the capture may have
+ * polled the controller at other times, so a read matching the one
+ * before or after it is counted apart and does not fail.
+ *
+ * If the capture has the gamecube data line, the replies of the
+ * controller are decoded from it, and the simulated controller (gcdrv.h)
+ * answers the firmware with the latest status as of the same time.
+ * Otherwise, nothing is pressed.
+ *
+ * Every bit read must have been written after the previous falling edge
+ * of the clock (or after the latch for the first bit). The time from the
+ * write to the falling edge sampling it is the slack, reported per bit.
+ * The firmware serves 8 bits, or 72 in raw mode (-r, X held at power
+ * up). The line is left as is after that, so the bits a game reads past
+ * these are counted apart and not timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "nesdrv.h"
+#include "gcdrv.h"
+#include "trace.h"
+
+/* The firmware waits 500ms at power up */
+#define BOOT_US			600000.0
+
+/* Longest read: raw mode */
+#define MAX_READ_BITS	128
+
+/* Bits written by the firmware at each read */
+#define NES_BITS		8
+#define RAW_BITS		(8 * 9)
+
+/* Status byte 0 (see gamecubeUpdate) */
+#define GC_BTN_X		0x04
+
+/* Bit positions reported apart. The others are reported together. */
+#define SLACK_BITS		8
+
+/* A low level starting this long after the end of the previous one
+ * starts a new gamecube command. */
+#define GC_IDLE_US		20.0
+
+#define MAX_MISMATCHES	10
+
+struct read {
+	double t_us;		// latch, in trace time
+	int expected_bits, got_bits;
+	unsigned char expected[MAX_READ_BITS / 8];
+	unsigned char got[MAX_READ_BITS / 8];
+};
+
+/* Replies of the controller decoded from the capture */
+struct gc_update {
+	double t_us;		// end of the reply
+	unsigned char cmd;
+	unsigned char data[GCDRV_MAX_REPLY];
+};
+
+struct replay {
+	struct sim s;
+	struct nesdrv d;
+	struct gcdrv g;
+	const struct trace *t;
+
+	struct read *reads;
+	int n_reads, read;
+
+	struct gc_update *updates;
+	int n_updates, update, alloc_updates;
+
+	int served;			// NES_BITS or RAW_BITS
+	unsigned long unserved;
+
+	size_t ev;			// next event
+	avr_cycle_count_t start;	// trace event 0
+	int latch, clock;
+	avr_cycle_count_t prev_edge;
+
+	struct sim_hist slack_first, slack_next;
+	avr_cycle_count_t slack_min[SLACK_BITS + 1];
+	double slack_sum[SLACK_BITS + 1];
+	unsigned long slack_count[SLACK_BITS + 1];
+	unsigned long late[SLACK_BITS + 1];
+};
+
+static void setBit(unsigned char *buf, int bit, int level)
+{
+	if (level) {
+		buf[bit >> 3] |= 0x80 >> (bit & 7);
+	} else {
+		buf[bit >> 3] &= ~(0x80 >> (bit & 7));
+	}
+}
+
+static int getBit(const unsigned char *buf, int bit)
+{
+	return (buf[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* Split the reads at the latches and take the expected bits from the
+ * data line at each falling clock edge. */
+static int findReads(struct replay *r)
+{
+	const struct trace *t = r->t;
+	int level[TRACE_SIGNALS] = { -1, -1, -1, -1 };
+	struct read *rd = NULL;
+	size_t i, alloc = 0;
+
+	for (i=0; i<t->n; i++) {
+		const struct trace_event *e = &t->ev[i];
+		int prev = level[e->sig];
+
+		level[e->sig] = e->level;
+		if (prev < 0)
+			continue;
+
+		if (e->sig == TRACE_LATCH && e->level) {
+			if (r->n_reads == alloc) {
+				alloc = alloc ? alloc * 2 : 1024;
+				r->reads = realloc(r->reads, alloc * sizeof(struct read));
+				if (!r->reads)
+					return -1;
+			}
+			rd = &r->reads[r->n_reads++];
+			memset(rd, 0, sizeof(struct read));
+			rd->t_us = e->t_us;
+		}
+		else if (e->sig == TRACE_CLOCK && !e->level && rd) {
+			if (rd->expected_bits < MAX_READ_BITS && level[TRACE_DATA] >= 0) {
+				setBit(rd->expected, rd->expected_bits++, level[TRACE_DATA]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int gcCommandLength(unsigned char c)
+{
+	switch (c)
+	{
+		case 0x40: case 0x42: case 0x43: case 0x54:
+			return 3;
+	}
+	return 1;
+}
+
+/* One message: the command, its stop bit, the reply and its stop bit. */
+static int gcMessage(struct replay *r, const double *fall, const double *rise, int n)
+{
+	struct gc_update *u;
+	unsigned char cmd = 0;
+	int i, first, bits, len;
+
+	if (n < 9)
+		return 0;
+
+	for (i=0; i<8; i++) {
+		cmd = (cmd << 1) | (rise[i] - fall[i] < fall[i + 1] - rise[i]);
+	}
+
+	first = gcCommandLength(cmd) * 8 + 1;
+	bits = n - first - 1;
+	len = cmd == 0x00 ? 24 : cmd == 0x40 ? 64 : 0;
+	if (!len || bits != len)
+		return 0;
+
+	if (r->n_updates == r->alloc_updates) {
+		r->alloc_updates = r->alloc_updates ? r->alloc_updates * 2 : 1024;
+		r->updates = realloc(r->updates, r->alloc_updates * sizeof(struct gc_update));
+		if (!r->updates)
+			return -1;
+	}
+	u = &r->updates[r->n_updates++];
+	memset(u, 0, sizeof(struct gc_update));
+	u->t_us = rise[n - 1];
+	u->cmd = cmd;
+
+	for (i=0; i<bits; i++) {
+		setBit(u->data, i, rise[first + i] - fall[first + i] <
+							fall[first + i + 1] - rise[first + i]);
+	}
+
+	return 0;
+}
+
+static int findUpdates(struct replay *r)
+{
+	const struct trace *t = r->t;
+	double fall[GCDRV_MAX_CMD * 8 + GCDRV_MAX_REPLY * 8 + 2];
+	double rise[sizeof(fall) / sizeof(fall[0])];
+	int n = 0, low = -1, max = sizeof(fall) / sizeof(fall[0]);
+	size_t i;
+
+	for (i=0; i<t->n; i++) {
+		const struct trace_event *e = &t->ev[i];
+
+		if (e->sig != TRACE_GC)
+			continue;
+
+		if (low < 0) {
+			low = !e->level;
+			continue;
+		}
+		low = !e->level;
+
+		if (low) {
+			if (n && (e->t_us - rise[n - 1] > GC_IDLE_US || n == max)) {
+				if (gcMessage(r, fall, rise, n))
+					return -1;
+				n = 0;
+			}
+			fall[n] = e->t_us;
+		} else {
+			rise[n++] = e->t_us;
+		}
+	}
+
+	if (n && gcMessage(r, fall, rise, n))
+		return -1;
+
+	return 0;
+}
+
+static avr_cycle_count_t traceCycle(struct replay *r, double t_us)
+{
+	return r->start + sim_us(&r->s, t_us - r->t->ev[0].t_us);
+}
+
+static void sample(struct replay *r, avr_cycle_count_t now)
+{
+	struct read *rd = &r->reads[r->read];
+	avr_cycle_count_t slack = now - r->d.written;
+	int bit = rd->got_bits, pos = bit < SLACK_BITS ? bit : SLACK_BITS;
+
+	if (bit >= MAX_READ_BITS)
+		return;
+	setBit(rd->got, bit, r->d.level);
+	rd->got_bits++;
+
+	if (bit >= r->served) {
+		r->unserved++;
+		return;
+	}
+
+	sim_histAdd(bit ? &r->slack_next : &r->slack_first, slack);
+	if (slack < r->slack_min[pos])
+		r->slack_min[pos] = slack;
+	r->slack_sum[pos] += slack;
+	r->slack_count[pos]++;
+
+	/* The console read what was there for the previous bit */
+	if (r->d.written < r->prev_edge)
+		r->late[pos]++;
+}
+
+static avr_cycle_count_t replayEvent(struct avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct replay *r = param;
+	const struct trace *t = r->t;
+	const struct trace_event *e;
+	avr_cycle_count_t next_ev, next_up;
+
+	while (1) {
+		next_ev = r->ev < t->n ? traceCycle(r, t->ev[r->ev].t_us) : 0;
+		next_up = r->update < r->n_updates ? traceCycle(r, r->updates[r->update].t_us) : 0;
+
+		if (next_up && (!next_ev || next_up <= next_ev)) {
+			const struct gc_update *u = &r->updates[r->update];
+
+			if (next_up > when)
+				return next_up;
+			if (u->cmd == 0x00) {
+				memcpy(r->g.id, u->data, sizeof(r->g.id));
+			} else {
+				memcpy(r->g.status, u->data, sizeof(r->g.status));
+			}
+			r->update++;
+			continue;
+		}
+
+		if (!next_ev)
+			return 0;
+		if (next_ev > when)
+			return next_ev;
+
+		e = &t->ev[r->ev++];
+		if (e->sig == TRACE_LATCH) {
+			if (e->level && r->latch == 0) {
+				r->read++;
+				r->prev_edge = when;
+			}
+			r->latch = e->level;
+			sim_setPin(&r->s, 'D', 2, e->level);
+		}
+		else if (e->sig == TRACE_CLOCK) {
+			if (!e->level && r->clock == 1 && r->read >= 0) {
+				sample(r, when);
+				r->prev_edge = when;
+			}
+			r->clock = e->level;
+			sim_setPin(&r->s, 'C', 1, e->level);
+		}
+	}
+}
+
+static void printRead(const char *what, const unsigned char *bits, int n)
+{
+	int i;
+
+	printf("      %-9s", what);
+	for (i=0; i<n; i++) {
+		putchar(getBit(bits, i) ? '1' : '0');
+		if ((i & 7) == 7)
+			putchar(' ');
+	}
+	putchar('\n');
+}
+
+static int sameBits(const unsigned char *a, const unsigned char *b, int n)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (getBit(a, i) != getBit(b, i))
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns the number of wrong reads */
+static int checkReads(struct replay *r)
+{
+	unsigned long ok = 0, shifted = 0, wrong = 0, bits = 0, bad_bits = 0;
+	int i, j, n;
+
+	for (i=0; i<r->n_reads; i++) {
+		struct read *rd = &r->reads[i];
+
+		n = rd->got_bits < rd->expected_bits ? rd->got_bits : rd->expected_bits;
+		bits += n;
+
+		if (sameBits(rd->got, rd->expected, n)) {
+			ok++;
+			continue;
+		}
+		if ((i > 0 && sameBits(rd->got, r->reads[i-1].expected, n)) ||
+				(i + 1 < r->n_reads && sameBits(rd->got, r->reads[i+1].expected, n))) {
+			shifted++;
+			continue;
+		}
+
+		for (j=0; j<n; j++) {
+			bad_bits += getBit(rd->got, j) != getBit(rd->expected, j);
+		}
+		if (wrong++ < MAX_MISMATCHES) {
+			printf("    read %d at %.3fms:\n", i, rd->t_us / 1000.0);
+			printRead("expected", rd->expected, n);
+			printRead("got", rd->got, n);
+		}
+	}
+
+	printf("  %lu bits compared, %lu wrong\n", bits, bad_bits);
+	printf("  reads: %lu match, %lu match the read before or after, %lu wrong\n",
+			ok, shifted, wrong);
+
+	return wrong;
+}
+
+static void printSlack(struct replay *r)
+{
+	int i;
+
+	printf("  slack (from the write of each bit to the falling edge reading it):\n");
+	printf("    bit      min       avg  late\n");
+	for (i=0; i<=SLACK_BITS; i++) {
+		if (!r->slack_count[i])
+			continue;
+		printf("    %2d%s %7.3fus %7.3fus  %lu\n", i, i == SLACK_BITS ? "+" : " ",
+				sim_toUs(&r->s, r->slack_min[i]),
+				sim_toUs(&r->s, r->slack_sum[i] / r->slack_count[i]), r->late[i]);
+	}
+	sim_histPrint(&r->s, &r->slack_first);
+	sim_histPrint(&r->s, &r->slack_next);
+}
+
+static void usage(void)
+{
+	printf("Usage: replay [-f freq] [-r] [-s signal=name] mcu elf trace\n");
+	printf("   mcu: atmega8 or atmega168\n");
+	printf("   -r: raw mode (X held at power up)\n");
+	printf("   -s: name of the latch, clock, data or gc signal in the trace\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct replay r;
+	struct trace t;
+	const char *names[TRACE_SIGNALS] = { };
+	uint32_t freq = 0;
+	unsigned long late = 0;
+	avr_cycle_count_t next, end;
+	char *eq;
+	int opt, i, res = 0;
+
+	r.served = NES_BITS;
+
+	while ((opt = getopt(argc, argv, "f:rs:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'r': r.served = RAW_BITS; break;
+			case 's':
+				eq = strchr(optarg, '=');
+				for (i=0; eq && i<TRACE_SIGNALS; i++) {
+					if (!strncmp(optarg, trace_signalName(i), eq - optarg))
+						break;
+				}
+				if (!eq || i == TRACE_SIGNALS) {
+					usage();
+					return 1;
+				}
+				names[i] = eq + 1;
+				break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 3) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+
+	if (trace_load(&t, argv[optind + 2], names))
+		return 1;
+	if (!t.present[TRACE_LATCH] || !t.present[TRACE_CLOCK]) {
+		fprintf(stderr, "%s: the latch and clock signals are required\n", argv[optind + 2]);
+		return 1;
+	}
+
+	r.t = &t;
+	r.read = -1;
+	r.latch = r.clock = -1;
+	if (findReads(&r) || findUpdates(&r)) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	if (sim_load(&r.s, argv[optind + 1], argv[optind], freq))
+		return 1;
+	nesdrv_monitor(&r.d, &r.s);
+	gcdrv_init(&r.g, &r.s);
+	if (r.served == RAW_BITS) {
+		/* Until the first reply of the capture, if any */
+		r.g.status[0] |= GC_BTN_X;
+	}
+	sim_histInit(&r.slack_first, "first bit", sim_us(&r.s, 0.5));
+	sim_histInit(&r.slack_next, "next bits", sim_us(&r.s, 0.25));
+	for (i=0; i<=SLACK_BITS; i++)
+		r.slack_min[i] = ~(avr_cycle_count_t)0;
+
+	/* The levels at the start of the capture are there from power up */
+	r.start = sim_us(&r.s, BOOT_US);
+	next = replayEvent(r.s.avr, r.start, &r);
+	if (next)
+		avr_cycle_timer_register(r.s.avr, next - r.s.avr->cycle, replayEvent, &r);
+
+	end = traceCycle(&r, t.ev[t.n - 1].t_us) + sim_us(&r.s, 1000);
+	if (sim_runUntil(&r.s, end))
+		res = 1;
+
+	printf("%s, %s at %luHz, %s\n", argv[optind + 1], argv[optind],
+			(unsigned long)freq, argv[optind + 2]);
+	printf("  %d reads, %.3f seconds\n", r.n_reads,
+			(t.ev[t.n - 1].t_us - t.ev[0].t_us) / 1e6);
+	if (t.present[TRACE_GC]) {
+		printf("  %d controller replies in the capture, %lu commands answered\n",
+				r.n_updates, r.g.replies);
+	}
+
+	if (t.present[TRACE_DATA]) {
+		if (checkReads(&r))
+			res = 1;
+	} else {
+		printf("  no data line in the capture, bits not compared\n");
+	}
+
+	printSlack(&r);
+	if (r.unserved) {
+		printf("  %lu bits read past the %d served, not timed\n", r.unserved, r.served);
+	}
+	for (i=0; i<=SLACK_BITS; i++)
+		late += r.late[i];
+	if (late) {
+		printf("  %lu bits were not written in time\n", late);
+		res = 1;
+	}
+
+	avr_terminate(r.s.avr);
+	trace_free(&t);
+
+	return res;
+}
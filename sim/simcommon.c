@@ -0,0 +1,230 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "simcommon.h"
+
+static const struct {
+	const char *mcu;
+	uint32_t freq;			// from the Makefiles
+	struct sim_ports ports;
+} sim_mcus[] = {
+	{ "atmega8", 16000000, { 0x38, 0x37, 0x35, 0x34, 0x32, 0x31 } },
+	{ "atmega168", 12000000, { 0x25, 0x24, 0x28, 0x27, 0x2B, 0x2A } },
+	{ }
+};
+
+/* avr-gcc links the data space at this address */
+#define SIM_DATA_OFFSET		0x800000
+
+uint32_t sim_defaultFreq(const char *mcu)
+{
+	int i;
+
+	for (i=0; sim_mcus[i].mcu; i++) {
+		if (!strcmp(sim_mcus[i].mcu, mcu))
+			return sim_mcus[i].freq;
+	}
+	return 0;
+}
+
+int sim_load(struct sim *s, const char *elf, const char *mcu, uint32_t freq)
+{
+	elf_firmware_t f;
+	int i;
+
+	memset(s, 0, sizeof(struct sim));
+	memset(&f, 0, sizeof(f));
+
+	for (i=0; sim_mcus[i].mcu; i++) {
+		if (!strcmp(sim_mcus[i].mcu, mcu))
+			break;
+	}
+	if (!sim_mcus[i].mcu) {
+		fprintf(stderr, "Unsupported mcu: %s\n", mcu);
+		return -1;
+	}
+	s->ports = sim_mcus[i].ports;
+
+	if (elf_read_firmware(elf, &f)) {
+		fprintf(stderr, "Could not read %s\n", elf);
+		return -1;
+	}
+	strncpy(f.mmcu, mcu, sizeof(f.mmcu) - 1);
+	f.frequency = freq;
+
+	s->avr = avr_make_mcu_by_name(f.mmcu);
+	if (!s->avr) {
+		fprintf(stderr, "simavr does not know %s\n", mcu);
+		return -1;
+	}
+	avr_init(s->avr);
+	avr_load_firmware(s->avr, &f);
+
+	s->elf = elf;
+	s->mcu = mcu;
+	s->freq = freq;
+
+	return 0;
+}
+
+/* The AVR ELF files are 32 bit and little endian, like the hosts the
+ * tools run on. */
+avr_io_addr_t sim_findVariable(const struct sim *s, const char *name)
+{
+	FILE *fp;
+	Elf32_Ehdr eh;
+	Elf32_Shdr *sh = NULL;
+	Elf32_Sym sym;
+	char *str = NULL;
+	avr_io_addr_t addr = 0;
+	unsigned long i, n, str_size;
+
+	fp = fopen(s->elf, "rb");
+	if (!fp)
+		return 0;
+
+	if (fread(&eh, sizeof(eh), 1, fp) != 1 || memcmp(eh.e_ident, ELFMAG, SELFMAG) ||
+			eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_shentsize != sizeof(Elf32_Shdr))
+		goto done;
+
+	sh = calloc(eh.e_shnum, sizeof(Elf32_Shdr));
+	if (!sh || fseek(fp, eh.e_shoff, SEEK_SET) ||
+			fread(sh, sizeof(Elf32_Shdr), eh.e_shnum, fp) != eh.e_shnum)
+		goto done;
+
+	for (i=0; i<eh.e_shnum && !addr; i++) {
+		if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh.e_shnum)
+			continue;
+
+		/* The names, NUL terminated */
+		str_size = sh[sh[i].sh_link].sh_size;
+		str = realloc(str, str_size + 1);
+		if (!str || fseek(fp, sh[sh[i].sh_link].sh_offset, SEEK_SET) ||
+				fread(str, 1, str_size, fp) != str_size)
+			goto done;
+		str[str_size] = 0;
+
+		if (fseek(fp, sh[i].sh_offset, SEEK_SET))
+			goto done;
+		for (n = sh[i].sh_size / sizeof(Elf32_Sym); n; n--) {
+			if (fread(&sym, sizeof(sym), 1, fp) != 1)
+				goto done;
+			if (ELF32_ST_TYPE(sym.st_info) == STT_OBJECT && sym.st_name < str_size &&
+					sym.st_value >= SIM_DATA_OFFSET && !strcmp(str + sym.st_name, name)) {
+				addr = sym.st_value - SIM_DATA_OFFSET;
+				break;
+			}
+		}
+	}
+
+done:
+	free(str);
+	free(sh);
+	fclose(fp);
+
+	return addr;
+}
+
+int sim_runUntil(struct sim *s, avr_cycle_count_t cycle)
+{
+	int state;
+
+	while (s->avr->cycle < cycle) {
+		state = avr_run(s->avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "Simulated cpu stopped at cycle %llu\n",
+					(unsigned long long)s->avr->cycle);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void sim_setPin(struct sim *s, char port, int pin, int level)
+{
+	avr_raise_irq(avr_io_getirq(s->avr, AVR_IOCTL_IOPORT_GETIRQ(port), pin), level ? 1 : 0);
+}
+
+void sim_watchWrite(struct sim *s, avr_io_addr_t addr,
+					void (*cb)(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param),
+					void *param)
+{
+	/* The port module already handles these registers. simavr calls
+	 * all the handlers registered for an address. */
+	avr_register_io_write(s->avr, addr, cb, param);
+}
+
+void sim_histInit(struct sim_hist *h, const char *name, avr_cycle_count_t bin)
+{
+	memset(h, 0, sizeof(struct sim_hist));
+	h->name = name;
+	h->bin = bin ? bin : 1;
+	h->min = ~(avr_cycle_count_t)0;
+}
+
+void sim_histAdd(struct sim_hist *h, avr_cycle_count_t value)
+{
+	avr_cycle_count_t i = value / h->bin;
+
+	if (i >= SIM_HIST_BINS)
+		i = SIM_HIST_BINS - 1;
+	h->bins[i]++;
+
+	if (value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->sum += value;
+	h->count++;
+}
+
+void sim_histPrint(const struct sim *s, const struct sim_hist *h)
+{
+	unsigned long peak = 0;
+	int i, last = 0, n;
+
+	printf("  %s: ", h->name);
+	if (!h->count) {
+		printf("no samples\n");
+		return;
+	}
+	printf("%lu samples, min %.3fus, avg %.3fus, max %.3fus\n", h->count,
+			sim_toUs(s, h->min), sim_toUs(s, h->sum / h->count),
+			sim_toUs(s, h->max));
+
+	for (i=0; i<SIM_HIST_BINS; i++) {
+		if (h->bins[i] > peak)
+			peak = h->bins[i];
+		if (h->bins[i])
+			last = i;
+	}
+
+	for (i=h->min / h->bin; i<=last; i++) {
+		printf("    %s%7.3fus %8lu ", i == SIM_HIST_BINS - 1 ? ">=" : "  ",
+				sim_toUs(s, i * h->bin), h->bins[i]);
+		for (n = h->bins[i] * 40 / peak; n; n--)
+			putchar('#');
+		putchar('\n');
+	}
+}
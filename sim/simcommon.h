@@ -0,0 +1,81 @@
+#ifndef _simcommon_h__
+#define _simcommon_h__
+
+/* Helpers shared by the simulation tools. The firmware ELF is run
+ * unmodified by simavr. */
+
+#include <stdint.h>
+#include "sim_avr.h"
+#include "sim_cycle_timers.h"
+
+/* Data space addresses of the port registers. */
+struct sim_ports {
+	avr_io_addr_t portb, ddrb;
+	avr_io_addr_t portc, ddrc;
+	avr_io_addr_t portd, ddrd;
+};
+
+struct sim {
+	avr_t *avr;
+	const char *elf;
+	const char *mcu;
+	uint32_t freq;
+	struct sim_ports ports;
+};
+
+/* Load the firmware. Returns 0 on success. */
+int sim_load(struct sim *s, const char *elf, const char *mcu, uint32_t freq);
+
+/* Run until the given cycle. Returns 0 on success, -1 if the simulated
+ * cpu stopped or crashed. */
+int sim_runUntil(struct sim *s, avr_cycle_count_t cycle);
+
+/* Data space address of a variable of the firmware (static ones too),
+ * from the symbol table of the ELF. 0 if it is not found. */
+avr_io_addr_t sim_findVariable(const struct sim *s, const char *name);
+
+static inline uint16_t sim_read16(const struct sim *s, avr_io_addr_t addr)
+{
+	return s->avr->data[addr] | (s->avr->data[addr + 1] << 8);
+}
+
+/* Drive an input pin from outside. */
+void sim_setPin(struct sim *s, char port, int pin, int level);
+
+/* Call back on every write to an IO register, whether it changes the
+ * value or not. */
+void sim_watchWrite(struct sim *s, avr_io_addr_t addr,
+					void (*cb)(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param),
+					void *param);
+
+static inline avr_cycle_count_t sim_us(const struct sim *s, double us)
+{
+	return (avr_cycle_count_t)(us * s->freq / 1000000.0 + 0.5);
+}
+
+static inline double sim_toUs(const struct sim *s, avr_cycle_count_t cycles)
+{
+	return cycles * 1000000.0 / s->freq;
+}
+
+/* Command line helpers: "atmega8" and "atmega168" are the supported
+ * builds, at the frequency of their Makefile unless given. */
+uint32_t sim_defaultFreq(const char *mcu);
+
+/* Latency histogram, in cycles. */
+#define SIM_HIST_BINS	32
+
+struct sim_hist {
+	const char *name;
+	avr_cycle_count_t bin;		// cycles per bin
+	unsigned long count;
+	avr_cycle_count_t min, max;
+	double sum;
+	unsigned long bins[SIM_HIST_BINS];	// last bin: everything longer
+};
+
+void sim_histInit(struct sim_hist *h, const char *name, avr_cycle_count_t bin);
+void sim_histAdd(struct sim_hist *h, avr_cycle_count_t value);
+void sim_histPrint(const struct sim *s, const struct sim_hist *h);
+
+#endif // _simcommon_h__
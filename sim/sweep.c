@@ -0,0 +1,321 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Receive path sweep: varies two timing parameters of the simulated
+ * controller (gcdrv.h) over a grid and prints a pass/fail map. A point
+ * passes if the firmware received every reply sent with its timing
+ * with the right number of bits (-n replies).
+ *
+ * With -z, the points are instead drawn at random with every parameter
+ * in its usual range (gcdrv_params), and the failing ones are listed.
+ *
+ * All points are run in one simulation, one after the other. A failing
+ * point makes the firmware start over with a get id, which is judged
+ * with the next point.
+ *
+ * Not run yet: this was only compiled against stub simavr headers, and
+ * no map has been produced. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "simcommon.h"
+#include "gcdrv.h"
+
+/* The firmware waits 500ms at power up */
+#define BOOT_US			500000.0
+
+/* A point fails if the firmware sends no command for this long */
+#define STALL_US		100000.0
+#define RUN_SLICE_US	10000.0
+
+#define MAX_LISTED		20
+
+struct axis {
+	int param;
+	double from, to;
+	int steps;
+};
+
+struct point {
+	struct gcdrv_timing timing;
+	unsigned long judged;
+	char result;		// 0: not run, 1: pass, -1: fail
+};
+
+struct run {
+	struct gcdrv g;
+	struct point *points;
+	int n_points, point;
+	unsigned long per_point;
+};
+
+static void startPoint(struct run *r)
+{
+	if (r->point < r->n_points) {
+		r->g.timing = r->points[r->point].timing;
+		r->g.tag = r->point;
+	} else {
+		r->g.timing = gcdrv_default_timing;
+		r->g.tag = -1;
+	}
+}
+
+static void endPoint(struct run *r, int ok)
+{
+	r->points[r->point].result = ok ? 1 : -1;
+	r->point++;
+	startPoint(r);
+}
+
+static void onResult(struct gcdrv *g, unsigned char cmd, int tag, int ok)
+{
+	struct run *r = g->param;
+	struct point *p;
+
+	if (tag != r->point || r->point >= r->n_points)
+		return;
+
+	p = &r->points[r->point];
+	p->judged++;
+	if (!ok || p->judged >= r->per_point)
+		endPoint(r, ok);
+}
+
+/* Returns 0 if all the points were run */
+static int runPoints(struct run *r, const char *elf, const char *mcu, uint32_t freq,
+						const unsigned char *id)
+{
+	struct sim s;
+	avr_cycle_count_t t, last_progress = 0;
+	unsigned long commands = 0;
+	int res = 0;
+
+	if (sim_load(&s, elf, mcu, freq))
+		return -1;
+
+	gcdrv_init(&r->g, &s);
+	memcpy(r->g.id, id, sizeof(r->g.id));
+	r->g.onResult = onResult;
+	r->g.param = r;
+	r->point = 0;
+	startPoint(r);
+
+	for (t = sim_us(&s, BOOT_US); r->point < r->n_points; t += sim_us(&s, RUN_SLICE_US)) {
+		if (sim_runUntil(&s, t)) {
+			res = -1;
+			break;
+		}
+
+		if (r->g.commands != commands) {
+			commands = r->g.commands;
+			last_progress = t;
+		} else if (t - last_progress > sim_us(&s, STALL_US)) {
+			endPoint(r, 0);
+			last_progress = t;
+		}
+	}
+
+	avr_terminate(s.avr);
+	return res;
+}
+
+static double axisValue(const struct axis *a, int i)
+{
+	if (a->steps < 2)
+		return a->from;
+	return a->from + (a->to - a->from) * i / (a->steps - 1);
+}
+
+static int parseAxis(struct axis *a, const char *arg)
+{
+	char key[32];
+	int n;
+
+	n = sscanf(arg, "%31[^:]:%lf:%lf:%d", key, &a->from, &a->to, &a->steps);
+	a->param = gcdrv_findParam(key);
+	if (a->param < 0)
+		return -1;
+
+	if (n == 1) {
+		a->from = gcdrv_params[a->param].lo;
+		a->to = gcdrv_params[a->param].hi;
+	}
+	if (n < 4)
+		a->steps = 16;
+
+	return n == 1 || n >= 3 ? 0 : -1;
+}
+
+static void printTiming(const struct gcdrv_timing *t)
+{
+	printf("short %.3fus long %.3fus stop %.3fus delay %.3fus jitter %.3fus gap %.3fus",
+			t->short_us, t->long_us, t->stop_us, t->delay_us, t->jitter_us, t->gap_us);
+}
+
+static void printMap(const struct run *r, const struct axis *x, const struct axis *y)
+{
+	const struct gcdrv_param *px = &gcdrv_params[x->param];
+	const struct gcdrv_param *py = &gcdrv_params[y->param];
+	int i, j;
+
+	printf("  rows: %s (%s), columns: %s from %.4f to %.4f%s in %d steps\n",
+			py->name, py->unit, px->name, x->from, x->to, px->unit, x->steps);
+	printf("  #: every reply received, .: at least one lost\n");
+
+	for (j=y->steps - 1; j>=0; j--) {
+		printf("  %9.4f ", axisValue(y, j));
+		for (i=0; i<x->steps; i++) {
+			char c = r->points[j * x->steps + i].result;
+			putchar(c > 0 ? '#' : c < 0 ? '.' : '?');
+		}
+		putchar('\n');
+	}
+}
+
+static double randomIn(double lo, double hi)
+{
+	return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+static void usage(void)
+{
+	printf("Usage: sweep [options] mcu elf\n");
+	printf("   mcu: atmega8 or atmega168\n");
+	printf("   -f freq     simulated clock (default: as the Makefile of the build)\n");
+	printf("   -x param[:from:to[:steps]]   columns (default short)\n");
+	printf("   -y param[:from:to[:steps]]   rows (default long)\n");
+	printf("   -n replies  per point (default 16)\n");
+	printf("   -i id       controller identity, hex (default 090020)\n");
+	printf("   -z points   random points instead of a grid\n");
+	printf("   -s seed     for -z and the jitter\n");
+	printf("   -o file     also write the points as CSV\n");
+	printf("   params: short, long, scale, stop, delay, jitter, gap\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct run r;
+	struct axis x = { GCDRV_SHORT }, y = { GCDRV_LONG };
+	uint32_t freq = 0;
+	unsigned long id = 0x090020, seed = 1, passed = 0;
+	unsigned char id_bytes[3];
+	const char *csv = NULL;
+	int opt, i, j, n_random = 0, listed = 0;
+	FILE *fp;
+
+	x.from = gcdrv_params[x.param].lo; x.to = gcdrv_params[x.param].hi; x.steps = 16;
+	y.from = gcdrv_params[y.param].lo; y.to = gcdrv_params[y.param].hi; y.steps = 16;
+	r.per_point = 16;
+
+	while ((opt = getopt(argc, argv, "f:x:y:n:i:z:s:o:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'x': if (parseAxis(&x, optarg)) { usage(); return 1; } break;
+			case 'y': if (parseAxis(&y, optarg)) { usage(); return 1; } break;
+			case 'n': r.per_point = strtoul(optarg, NULL, 0); break;
+			case 'i': id = strtoul(optarg, NULL, 16); break;
+			case 'z': n_random = atoi(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'o': csv = optarg; break;
+			default: usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2 || r.per_point < 1 || x.steps < 1 || y.steps < 1) {
+		usage();
+		return 1;
+	}
+	if (!freq)
+		freq = sim_defaultFreq(argv[optind]);
+	id_bytes[0] = id >> 16;
+	id_bytes[1] = id >> 8;
+	id_bytes[2] = id;
+	srand(seed);
+
+	r.n_points = n_random ? n_random : x.steps * y.steps;
+	r.points = calloc(r.n_points, sizeof(struct point));
+	if (!r.points)
+		return 1;
+
+	for (i=0; i<r.n_points; i++) {
+		struct gcdrv_timing *t = &r.points[i].timing;
+
+		*t = gcdrv_default_timing;
+		if (n_random) {
+			for (j=0; j<GCDRV_PARAMS; j++) {
+				if (j != GCDRV_SCALE)
+					gcdrv_setParam(t, j, randomIn(gcdrv_params[j].lo, gcdrv_params[j].hi));
+			}
+		} else {
+			/* The bit length sets the levels: it goes first. */
+			if (y.param == GCDRV_SCALE)
+				gcdrv_setParam(t, y.param, axisValue(&y, i / x.steps));
+			gcdrv_setParam(t, x.param, axisValue(&x, i % x.steps));
+			if (y.param != GCDRV_SCALE)
+				gcdrv_setParam(t, y.param, axisValue(&y, i / x.steps));
+		}
+	}
+
+	printf("%s, %s at %luHz, id %06lx, %lu replies per point\n", argv[optind + 1],
+			argv[optind], (unsigned long)freq, id, r.per_point);
+
+	if (runPoints(&r, argv[optind + 1], argv[optind], freq, id_bytes)) {
+		printf("  the simulation stopped at point %d of %d\n", r.point, r.n_points);
+		return 1;
+	}
+
+	for (i=0; i<r.n_points; i++) {
+		if (r.points[i].result > 0)
+			passed++;
+	}
+
+	if (n_random) {
+		for (i=0; i<r.n_points && listed < MAX_LISTED; i++) {
+			if (r.points[i].result > 0)
+				continue;
+			printf("  lost a reply with ");
+			printTiming(&r.points[i].timing);
+			putchar('\n');
+			listed++;
+		}
+	} else {
+		printMap(&r, &x, &y);
+	}
+	printf("  %lu of %d points passed\n", passed, r.n_points);
+
+	if (csv) {
+		fp = fopen(csv, "w");
+		if (!fp) {
+			perror(csv);
+			return 1;
+		}
+		fprintf(fp, "short_us,long_us,stop_us,delay_us,jitter_us,gap_us,replies,pass\n");
+		for (i=0; i<r.n_points; i++) {
+			const struct point *p = &r.points[i];
+
+			fprintf(fp, "%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%lu,%d\n",
+					p->timing.short_us, p->timing.long_us, p->timing.stop_us,
+					p->timing.delay_us, p->timing.jitter_us, p->timing.gap_us,
+					p->judged, p->result > 0);
+		}
+		fclose(fp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*  GC to NES : Gamecube controller to NES adapter
+    Copyright (C) 2026  agent <agent@local>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "trace.h"
+
+/* VCD identifiers and CSV columns */
+#define MAX_VARS	64
+#define MAX_LINE	1024
+
+static const char *signal_names[TRACE_SIGNALS] = { "latch", "clock", "data", "gc" };
+
+const char *trace_signalName(int sig)
+{
+	return sig >= 0 && sig < TRACE_SIGNALS ? signal_names[sig] : "?";
+}
+
+static int trace_contains(const char *name, const char *word)
+{
+	size_t n = strlen(word);
+
+	for (; *name; name++) {
+		if (!strncasecmp(name, word, n))
+			return 1;
+	}
+	return 0;
+}
+
+static int trace_signalFor(const char *name, const char *names[TRACE_SIGNALS])
+{
+	int i;
+
+	if (names) {
+		for (i=0; i<TRACE_SIGNALS; i++) {
+			if (names[i] && !strcasecmp(name, names[i]))
+				return i;
+		}
+	}
+
+	if (trace_contains(name, "gc") || trace_contains(name, "gamecube"))
+		return TRACE_GC;
+	if (trace_contains(name, "latch"))
+		return TRACE_LATCH;
+	if (trace_contains(name, "clock") || trace_contains(name, "clk"))
+		return TRACE_CLOCK;
+	if (trace_contains(name, "data"))
+		return TRACE_DATA;
+
+	return -1;
+}
+
+static int trace_add(struct trace *t, int last[TRACE_SIGNALS], double t_us, int sig, int level)
+{
+	struct trace_event *e;
+
+	if (sig < 0 || level < 0 || last[sig] == level)
+		return 0;
+	last[sig] = level;
+
+	if (t->n == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 4096;
+		e = realloc(t->ev, t->alloc * sizeof(struct trace_event));
+		if (!e)
+			return -1;
+		t->ev = e;
+	}
+
+	e = &t->ev[t->n++];
+	e->t_us = t_us;
+	e->sig = sig;
+	e->level = level;
+	t->present[sig] = 1;
+
+	return 0;
+}
+
+static double trace_unitUs(const char *s)
+{
+	double n = strtod(s, (char**)&s);
+
+	if (n == 0)
+		n = 1;
+	while (isspace((unsigned char)*s))
+		s++;
+
+	if (!strncmp(s, "fs", 2)) return n / 1e9;
+	if (!strncmp(s, "ps", 2)) return n / 1e6;
+	if (!strncmp(s, "ns", 2)) return n / 1e3;
+	if (!strncmp(s, "us", 2)) return n;
+	if (!strncmp(s, "ms", 2)) return n * 1e3;
+	return n * 1e6; // s
+}
+
+static int trace_loadVcd(struct trace *t, FILE *fp, const char *names[TRACE_SIGNALS])
+{
+	char tok[MAX_LINE], scale[MAX_LINE] = "1ns";
+	char ids[MAX_VARS][16];
+	int sigs[MAX_VARS], last[TRACE_SIGNALS];
+	int n_vars = 0, i, level;
+	double unit, now = 0;
+	char type[16], id[16], name[MAX_LINE];
+	int width;
+
+	for (i=0; i<TRACE_SIGNALS; i++)
+		last[i] = -1;
+
+	/* Header */
+	while (fscanf(fp, "%1023s", tok) == 1) {
+		if (!strcmp(tok, "$enddefinitions"))
+			break;
+
+		if (!strcmp(tok, "$timescale")) {
+			scale[0] = 0;
+			while (fscanf(fp, "%1023s", tok) == 1 && strcmp(tok, "$end")) {
+				strncat(scale, tok, sizeof(scale) - strlen(scale) - 1);
+			}
+		}
+		else if (!strcmp(tok, "$var")) {
+			if (fscanf(fp, "%15s %d %15s %1023s", type, &width, id, name) != 4)
+				return -1;
+			if (width == 1 && n_vars < MAX_VARS) {
+				strcpy(ids[n_vars], id);
+				sigs[n_vars] = trace_signalFor(name, names);
+				n_vars++;
+			}
+		}
+	}
+	unit = trace_unitUs(scale);
+
+	/* Value changes. $dumpvars and friends only wrap them. */
+	while (fscanf(fp, "%1023s", tok) == 1) {
+		if (tok[0] == '#') {
+			now = strtod(tok + 1, NULL) * unit;
+			continue;
+		}
+		if (tok[0] == 'b' || tok[0] == 'B' || tok[0] == 'r' || tok[0] == 'R') {
+			// vector: the identifier follows
+			if (fscanf(fp, "%1023s", tok) != 1)
+				break;
+			continue;
+		}
+		if (!strchr("01xXzZ", tok[0]))
+			continue;
+
+		level = tok[0] == '1' ? 1 : tok[0] == '0' ? 0 : -1;
+		for (i=0; i<n_vars; i++) {
+			if (!strcmp(ids[i], tok + 1)) {
+				if (trace_add(t, last, now, sigs[i], level))
+					return -1;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int trace_loadCsv(struct trace *t, FILE *fp, const char *names[TRACE_SIGNALS])
+{
+	char line[MAX_LINE];
+	int sigs[MAX_VARS], last[TRACE_SIGNALS];
+	int n_cols = 0, col, i;
+	double unit = 1e6, now;
+	char *p, *field;
+
+	for (i=0; i<TRACE_SIGNALS; i++)
+		last[i] = -1;
+
+	if (!fgets(line, sizeof(line), fp))
+		return -1;
+
+	for (p = line; (field = strsep(&p, ",\r\n")) && n_cols < MAX_VARS; ) {
+		while (*field == ' ' || *field == '"')
+			field++;
+		if (*field == 0 && !p)
+			break;
+		field[strcspn(field, "\"")] = 0;
+
+		if (n_cols == 0) {
+			if (strstr(field, "[ms]")) unit = 1e3;
+			if (strstr(field, "[us]")) unit = 1;
+			if (strstr(field, "[ns]")) unit = 1e-3;
+			sigs[n_cols++] = -1;
+			continue;
+		}
+		sigs[n_cols++] = trace_signalFor(field, names);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		p = line;
+		field = strsep(&p, ",");
+		if (!p)
+			continue;
+		now = strtod(field, NULL) * unit;
+
+		for (col = 1; col < n_cols && (field = strsep(&p, ",\r\n")); col++) {
+			if (trace_add(t, last, now, sigs[col], atoi(field) ? 1 : 0))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+int trace_load(struct trace *t, const char *file, const char *names[TRACE_SIGNALS])
+{
+	FILE *fp;
+	const char *ext;
+	int res;
+
+	memset(t, 0, sizeof(struct trace));
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+
+	ext = strrchr(file, '.');
+	if (ext && !strcasecmp(ext, ".vcd")) {
+		res = trace_loadVcd(t, fp, names);
+	} else {
+		res = trace_loadCsv(t, fp, names);
+	}
+	fclose(fp);
+
+	if (res) {
+		fprintf(stderr, "%s: could not parse\n", file);
+		trace_free(t);
+		return -1;
+	}
+	if (!t->n) {
+		fprintf(stderr, "%s: no known signals\n", file);
+		return -1;
+	}
+
+	return 0;
+}
+
+void trace_free(struct trace *t)
+{
+	free(t->ev);
+	memset(t, 0, sizeof(struct trace));
+}
@@ -0,0 +1,43 @@
+#ifndef _trace_h__
+#define _trace_h__
+
+/* Logic analyzer captures of the NES and gamecube lines, in VCD or CSV.
+ *
+ * VCD: the one-bit variables are the signals.
+ *
+ * CSV: the first line names the columns. The first column is the time,
+ * in seconds unless its name says "[ms]", "[us]" or "[ns]" (as exported
+ * by most logic analyzer programs). The other columns are the levels (0
+ * or 1) from that time on.
+ *
+ * Signals are recognized by name (case insensitive): "gc" or "gamecube"
+ * for the gamecube data line, then "latch", "clock" or "clk", and "data"
+ * for the NES data line. Other names can be given to trace_load().
+ */
+
+#define TRACE_LATCH		0
+#define TRACE_CLOCK		1
+#define TRACE_DATA		2	// NES data, from the adapter
+#define TRACE_GC		3	// gamecube data line
+#define TRACE_SIGNALS	4
+
+struct trace_event {
+	double t_us;
+	unsigned char sig;
+	unsigned char level;
+};
+
+struct trace {
+	char present[TRACE_SIGNALS];
+	struct trace_event *ev;	// level changes in time order, starting
+	size_t n, alloc;		// with the initial levels
+};
+
+/* names: NULL, or the signal names to use instead (NULL entries for the
+ * default ones). Returns 0 on success. */
+int trace_load(struct trace *t, const char *file, const char *names[TRACE_SIGNALS]);
+void trace_free(struct trace *t);
+
+const char *trace_signalName(int sig);
+
+#endif // _trace_h__
@@ -14,8 +14,9 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include <avr/io.h>
+#include "hal.h"
 #include "atmega168compat.h"
+#include "sync.h"
 
 /* Forces the old behaviour which means a stable time distance 
  * between N64 poll and our Gamecube * poll. Sometimes useful
@@ -61,17 +62,119 @@
  * close in time. This is meant to prevent problems with games which
  * quick series of commands.
  *
+ * The times are taken by the latch interrupt (see sync_latch_event()),
+ * not when the main loop gets to them. A latch arriving during a
+ * gamecube transaction is therefore not seen as late.
+ *
+ * The duration between polls is not taken from a single frame. It
+ * is tracked by a filter which locks on the frame rate of the console
+ * once a few consecutive frames agree, and then ignores frames which
+ * do not fit (lag frames, extra latches, pauses). Until it is locked,
+ * the controller is polled continuously instead.
+ *
  */
 
 /* The time required to poll a gamecube controller is 300uS. 
  * The extra 150uS is a safety margin against jitter.
+ *
+ * Replies used to be decoded after reception, which took another
+ * 100uS, and each poll started with a GC_GETID transaction (150uS).
+ * Bits are now decoded as they are received and the ID is only
+ * read once in a while by gamecube.c. The occasional GC_GETID
+ * is covered by the margin, which never goes below MARGIN_MIN.
+ *
+ * This is only the starting point. The duration of each poll (from
+ * the start of the transaction to the data being ready for the NES)
+ * is measured, and a running high percentile of it is kept for each
+ * kind of controller: it rises quickly to a longer poll and only
+ * slowly comes down.
  * */
-#define TIME_TO_POLL				333	// 450uS
-#define MARGIN						666
+#define TIME_TO_POLL				(T64(333) - US_TO_TICKS(100 + 150))
+#define POLL_COST_SHIFT				4	// poll_cost fraction bits
+#define POLL_COST_RISE_SHIFT		2	// follows 1/4 of a longer poll
+#define POLL_COST_FALL_SHIFT		6	// and 1/64 of a shorter one
+
+/* Guard between the expected end of a poll and the expected latch. It
+ * starts at MARGIN and adapts: each poll done without being interrupted
+ * by a latch shrinks it a little, and a collision (a latch during a
+ * poll placed by the scheduler) doubles it. */
+#define MARGIN						T64(666)
+#define MARGIN_MIN					US_TO_TICKS(200)
+#define MARGIN_MAX					T64(1333)
+
+#define DEFAULT_THRESHOLD			T64(2333)	// approx 7ms at /64 prescaler
+
+/* A frame agrees with the estimated period if it is within 1/16 of it
+ * (approx. 1ms). */
+#define PERIOD_TOLERANCE(p)			((p) / 16)
+#define PERIOD_HISTORY				3
+#define LOCK_FRAMES					4	// agreeing frames to lock
+#define UNLOCK_FRAMES				3	// disagreeing frames to unlock
+#define PERIOD_GAIN_SHIFT			3	// the filter follows 1/8 of the error
 
-#define MIN_IDLE					1700 // 5ms
+/* Frame periods, in 1/256 of a tick. Famicom clones (Dendy) run at
+ * 50Hz as a PAL console does and cannot be told apart from it. */
+#define PERIOD_Q8(us)				((unsigned long)US_TO_TICKS((unsigned long)(us)) << 8)
+#define NTSC_PERIOD					PERIOD_Q8(16639)	// 60.10Hz
+#define PAL_PERIOD					PERIOD_Q8(19997)	// 50.01Hz
 
-#define DEFAULT_THRESHOLD			2333	// approx 7ms at /64 prescaler
+/* Many games read the controller several times in a row and compare
+ * the results (the DPCM channel can corrupt a read). Latches closer
+ * than this to each other are part of the same burst and must all see
+ * the same data. */
+#define BURST_GAP					US_TO_TICKS(1000)
+#define BURST_MAX					(MIN_IDLE / 2)
+
+/* When the poll is due in less than this, sync_may_poll() waits for the
+ * Timer1 compare match instead of returning to the main loop. The poll
+ * then starts a few cycles after the scheduled time, not up to one pass
+ * of the main loop later. Longer than the slowest pass of the loop. */
+#define SPIN_TICKS					US_TO_TICKS(200)
+
+/* A frame with this many latches means the game reads the controller
+ * without end. Latches within a read are counted as one (see struct
+ * sync_latch), so this is at least 4 reads. Scheduled polls would be interrupted, so polls are only
+ * placed in the idle gaps of the game's read loop (see sync_may_steal()).
+ * This lasts until the game leaves the controller alone for MIN_IDLE.
+ * A gap matches one a period earlier if they are within 1/8 of each
+ * other (plus a few ticks for the timer resolution). */
+#define DENSE_LATCHES				8
+#define GAP_MAX_PERIOD				(SYNC_GAP_RING / 2)
+#define GAP_TOLERANCE(g)			((g) / 8 + T64(2))
+#define STEAL_WINDOW				US_TO_TICKS(50)
+
+/* Extra polls for tap capture (see sync_may_sample()) are at least
+ * this far apart. */
+#define SAMPLE_INTERVAL				US_TO_TICKS(1000)
+
+/* Wireless receivers (Wavebird) only update their report when a radio
+ * packet arrives. The packet times are estimated from the polls which
+ * see the report change: the packet came between the previous poll and
+ * that one. The reply tells nothing else about the packets, so one
+ * which brings the same report as the last one goes unseen, and the
+ * time between two changes is a multiple of the packet period.
+ *
+ * The period is seeded from the shortest of PKT_SEED_INTERVALS such
+ * times, and seeded again when a change comes sooner than a period
+ * after the last one. A period and a phase are then tracked from the
+ * windows, counting the packets missed in between. The period follows
+ * 1/16 of the error, which is assumed to be within 1/64 per period in
+ * the phase windows.
+ *
+ * The scheduled poll is moved earlier, to just after the last packet
+ * before it, when this is less than the margin: the poll gets the same
+ * data, further from the latch. It is never delayed into the margin. */
+#define PKT_PERIOD_MIN				US_TO_TICKS(1000)
+#define PKT_PERIOD_MAX				US_TO_TICKS(20000)
+#define PKT_SEED_INTERVALS			4
+#define PKT_GAIN_SHIFT				4
+#define PKT_MAX_AGE					0xF000	// compared with the timer
+
+/* Without a latch for this long (245ms at 16MHz), the game stopped
+ * reading. The age of the frame is counted past the timer wrap
+ * (frame_age): with the /8 prescaler, the timer wraps after 33ms, less
+ * than two frames. */
+#define STALE_AGE					T64(0xF000UL)
 
 #define STATE_WAIT_THRES			0
 #define STATE_THRESHOLD_REACHED		1
@@ -79,78 +182,667 @@
 static unsigned int poll_threshold;
 static unsigned char state;
 
-#ifdef AT168_COMPATIBLE
-#define TIFR TIFR1
-#endif
+volatile struct sync_latch sync_latches[SYNC_LATCH_RING];
+volatile unsigned char sync_latch_head;
+volatile unsigned int sync_last_latch;
+volatile unsigned int sync_gaps[SYNC_GAP_RING];
+volatile unsigned char sync_gap_head;
+volatile unsigned int sync_idle_since;
+
+static unsigned long period_q8;		// estimated frame period, in 1/256 tick
+static unsigned int periods[PERIOD_HISTORY];
+static unsigned char n_periods;
+static unsigned char agree_count, disagree_count;
+static unsigned char locked;
+
+static unsigned int poll_cost[SYNC_POLL_KINDS];	// in 1/16 tick
+static unsigned char poll_kind;
+static unsigned int poll_start;
+static unsigned int poll_latch;
+static unsigned char poll_getid;		// the current poll has a GC_GETID
+
+static unsigned int margin;
+static unsigned char poll_scheduled;	// the scheduler asked for the current poll
+static unsigned int poll_count, collision_count;
+
+static unsigned int pkt_period;			// 0 when unknown
+static unsigned int pkt_time;			// a packet arrived at the latest then
+static unsigned int pkt_window;			// and at the earliest this much before
+static unsigned char pkt_valid;
+static unsigned int pkt_prev_poll;
+static unsigned char pkt_prev_valid;
+static unsigned int pkt_staleness;
+static unsigned int pkt_seed;			// shortest time between changes
+static unsigned char pkt_seed_count;	// seen before pkt_period is known
+
+static unsigned char latch_tail;		// last ring entry processed
+static unsigned int frame_start;		// time of the latest frame
+static unsigned char frame_valid;		// frame_start is recent
+static unsigned char dense;				// see sync_dense()
+static unsigned long frame_age;			// ticks since frame_start
+static unsigned int frame_age_at;		// timer value when it was updated
+
+/* The latch interrupt reads TCNT1. The 16 bit registers of Timer1 share
+ * a temporary register, so the main loop must access them with
+ * interrupts disabled. */
+static unsigned int sync_now(void)
+{
+	unsigned char sreg = SREG;
+	unsigned int t;
+
+	cli();
+	t = TCNT1;
+	SREG = sreg;
+
+	return t;
+}
+
+static void sync_setCompare(unsigned int t)
+{
+	unsigned char sreg = SREG;
+
+	cli();
+	OCR1A = t;
+	SREG = sreg;
+
+	TIFR = (1<<OCF1A); // clear pending match
+}
 
 void sync_init(void)
 {
 	TCCR1A = 0;
-	TCCR1B = (1<<CS11) | (1<<CS10);
+	TCCR1B = SYNC_TIMER_CS;
 	TCNT1 = 0;
 
-	/* /64 divisor. Overflows every 262ms */
+	/* /64 divisor. Overflows every 262ms (see sync.h). The timer is
+	 * never reset, only differences between timestamps are used. */
 	state = STATE_WAIT_THRES;
 	poll_threshold = DEFAULT_THRESHOLD;
+	frame_start = 0;
+	frame_valid = 0;
+	n_periods = 0;
+	locked = 0;
+	agree_count = 0;
+	dense = 0;
+
+	for (poll_kind=0; poll_kind<SYNC_POLL_KINDS; poll_kind++) {
+		poll_cost[poll_kind] = TIME_TO_POLL << POLL_COST_SHIFT;
+	}
+	poll_kind = 0;
+	margin = MARGIN;
 
+	sync_setCompare(poll_threshold);
 }
 
-void sync_master_polled_us(void)
+static unsigned int sync_medianPeriod(void)
 {
-	unsigned int elapsed;
-	int ignore_elapsed = 0;
+	unsigned int a = periods[0], b = periods[1], c = periods[2];
 
-	if (TIFR & (1<<TOV1)) {
-		TIFR |= 1<<TOV1; // clear overflow
+	/* With two frames, the shortest one is the safest. */
+	if (n_periods < 3)
+		return (n_periods < 2 || a < b) ? a : b;
 
-		/* The N64 is probably not polling. Revert to default
-		 * threshold instead of calculating an invalid one. */
-		poll_threshold = DEFAULT_THRESHOLD;
-		ignore_elapsed = 1;
-	}
+	if (a > b) { unsigned int t = a; a = b; b = t; }
+	if (b > c) { b = c; }
+	return a > b ? a : b;
+}
 
-	if (!ignore_elapsed) {
-		elapsed = TCNT1;
+static void sync_setThreshold(unsigned int period)
+{
 #ifdef OLD_MODE
-		if (elapsed > MIN_IDLE)
-			poll_threshold = 2; //MARGIN;
+	poll_threshold = 2; //MARGIN;
 #else
-		if (elapsed > MIN_IDLE)
-		{
-			if (elapsed > TIME_TO_POLL + MIN_IDLE + MARGIN) {
-				// Program the next GC poll at the last moment before the
-				// expected N64 poll.
-				poll_threshold = elapsed - TIME_TO_POLL - MARGIN;
+	unsigned int time_to_poll = poll_cost[poll_kind] >> POLL_COST_SHIFT;
+
+	if (period > time_to_poll + MIN_IDLE + margin) {
+		// Program the next GC poll at the last moment before the
+		// expected N64 poll.
+		poll_threshold = period - time_to_poll - margin;
+	} else {
+		poll_threshold = DEFAULT_THRESHOLD;
+	}
+
+	if (poll_threshold < MIN_IDLE) {
+		poll_threshold = DEFAULT_THRESHOLD;
+	}
+#endif
+}
+
+/* Returns non-zero if elapsed is close to a multiple (1 to 3) of the
+ * estimated period, as when the game skipped a latch. */
+static unsigned char sync_periodMultiple(unsigned int elapsed)
+{
+	unsigned long e = (unsigned long)elapsed << 8;
+	unsigned long tol = PERIOD_TOLERANCE(period_q8);
+	unsigned long p;
+	unsigned char k;
+
+	for (k=1, p=period_q8; k<=3; k++, p+=period_q8) {
+		if (e + tol > p && e < p + tol)
+			return k;
+	}
+	return 0;
+}
+
+static void sync_newFrame(unsigned int elapsed)
+{
+	unsigned char k;
+
+	if (locked) {
+		k = sync_periodMultiple(elapsed);
+		if (k) {
+			long err = (long)((((unsigned long)elapsed << 8) / k) - period_q8);
+
+			period_q8 += err >> PERIOD_GAIN_SHIFT;
+			disagree_count = 0;
+		} else if (++disagree_count >= UNLOCK_FRAMES) {
+			locked = 0;
+			agree_count = 0;
+			n_periods = 0;
+		}
+
+		if (locked)
+			return;
+	}
+
+	/* Acquisition: take the median of the last frames and lock once
+	 * enough consecutive frames agree with it. */
+	periods[2] = periods[1];
+	periods[1] = periods[0];
+	periods[0] = elapsed;
+	if (n_periods < PERIOD_HISTORY)
+		n_periods++;
+
+	period_q8 = (unsigned long)sync_medianPeriod() << 8;
+
+	if (sync_periodMultiple(elapsed) == 1) {
+		if (++agree_count >= LOCK_FRAMES) {
+			locked = 1;
+			disagree_count = 0;
+		}
+	} else {
+		agree_count = 0;
+	}
+}
+
+static char sync_packetKnown(void)
+{
+	if (!pkt_valid || !pkt_period)
+		return 0;
+
+	return (unsigned int)(sync_now() - pkt_time) < PKT_MAX_AGE;
+}
+
+/* Poll right after the last packet expected before the scheduled poll,
+ * if it is less than the margin before it. */
+static void sync_alignToPacket(void)
+{
+	unsigned int sched, last, early;
+
+	if (!locked || !sync_packetKnown())
+		return;
+
+	sched = frame_start + poll_threshold;
+	if ((unsigned int)(sched - pkt_time) >= PKT_MAX_AGE)
+		return;
+
+	last = pkt_time + pkt_period * ((unsigned int)(sched - pkt_time) / pkt_period);
+	early = sched - last;
+
+	if (early < margin && poll_threshold - early >= MIN_IDLE)
+		poll_threshold -= early;
+}
+
+/* Call after each poll of a wireless controller, with whether the
+ * report changed. */
+void sync_packet_poll(char changed)
+{
+	unsigned int t = poll_start;
+	unsigned int d, per, k;
+	long o, hi, lo;
+
+	if (changed && pkt_prev_valid) {
+		d = t - pkt_time;
+
+		/* Sooner than a period: it was a multiple of the real one. */
+		if (sync_packetKnown() && d + pkt_period / 2 < pkt_period) {
+			pkt_period = 0;
+			pkt_seed_count = 0;
+		}
+
+		if (sync_packetKnown()) {
+			/* Middle of the windows for the period, the upper bound
+			 * of the new one would make it too long. */
+			k = (d + pkt_period / 2) / pkt_period;
+			per = (d - (t - pkt_prev_poll) / 2 + pkt_window / 2) / k;
+			pkt_period += ((int)(per - pkt_period)) >> PKT_GAIN_SHIFT;
+
+			/* The packet came in the last (t - pkt_prev_poll) and the
+			 * prediction says o before t (give or take pkt_window).
+			 * Keep what agrees with both. */
+			o = (long)d - (long)k * pkt_period;
+			hi = o - (long)k * (pkt_period >> 6);
+			if (hi < 0)
+				hi = 0;
+			lo = o + pkt_window + (long)k * (pkt_period >> 6);
+			if (lo > (unsigned int)(t - pkt_prev_poll))
+				lo = (unsigned int)(t - pkt_prev_poll);
+			if (hi <= lo) {
+				pkt_time = t - hi;
+				pkt_window = lo - hi;
 			} else {
-				poll_threshold = DEFAULT_THRESHOLD;
+				pkt_time = t;
+				pkt_window = t - pkt_prev_poll;
 			}
-		
-			if (poll_threshold < MIN_IDLE) {
-				poll_threshold = DEFAULT_THRESHOLD;
+		} else {
+			if (pkt_valid) {
+				if (d >= PKT_PERIOD_MIN && d <= PKT_PERIOD_MAX) {
+					if (!pkt_seed_count || d < pkt_seed)
+						pkt_seed = d;
+					if (++pkt_seed_count >= PKT_SEED_INTERVALS) {
+						pkt_period = pkt_seed;
+						pkt_seed_count = 0;
+					}
+				}
 			}
+			pkt_time = t;
+			pkt_window = t - pkt_prev_poll;
+			pkt_valid = 1;
 		}
-#endif
 
+		if (pkt_period && (pkt_period < PKT_PERIOD_MIN || pkt_period > PKT_PERIOD_MAX))
+			pkt_period = 0;
 	}
 
-	/* Reset counter */
-	TCNT1 = 0;
-	TIFR |= (1<<TOV1); // clear overflow
-	state = STATE_WAIT_THRES;
+	pkt_prev_poll = t;
+	pkt_prev_valid = 1;
+
+	/* Age of the data served at the next latch: from the packet it came
+	 * from to the latch. */
+	if (locked && sync_packetKnown()) {
+		unsigned int last = pkt_time - pkt_window + pkt_period *
+			((unsigned int)(t - pkt_time) / pkt_period);
+
+		pkt_staleness = frame_start + ((period_q8 + 128) >> 8) - last;
+	}
+}
+
+/* In Timer1 ticks. 0 when unknown. */
+unsigned int sync_getStaleness(void)
+{
+	return sync_packetKnown() ? pkt_staleness : 0;
+}
+
+/* Non-zero while the game reads the controller without end. The latch
+ * count restarts with each window of MIN_IDLE (see sync_latch_event()),
+ * so once DENSE_LATCHES is reached, the state is kept until a latch-free
+ * MIN_IDLE, not lost at the first latches of the next window. */
+static char sync_dense(void)
+{
+	unsigned char sreg = SREG;
+	unsigned char count;
+	unsigned int last_latch;
+
+	cli();
+	count = sync_latches[sync_latch_head].count;
+	last_latch = sync_last_latch;
+	SREG = sreg;
+
+	if (count >= DENSE_LATCHES) {
+		dense = 1;
+	} else if ((unsigned int)(sync_now() - last_latch) >= MIN_IDLE) {
+		dense = 0;
+	}
+
+	return dense;
+}
+
+void sync_master_polled_us(void)
+{
+	unsigned int stamp;
+	unsigned char sreg;
+	char in_dense = sync_dense();
+
+	/* Each entry past latch_tail is a frame which started since the
+	 * last call. The ring is large enough for the main loop's latency;
+	 * if it was lapped, the oldest frames are simply lost.
+	 *
+	 * While the game latches without end, the entries are only windows
+	 * of MIN_IDLE, not frames: they are left out of the estimator, as is
+	 * the time from the last of them to the next real frame. */
+	while (latch_tail != sync_latch_head) {
+		latch_tail = (latch_tail + 1) & (SYNC_LATCH_RING - 1);
+
+		sreg = SREG;
+		cli();
+		stamp = sync_latches[latch_tail].stamp;
+		SREG = sreg;
+
+		if (frame_valid && !in_dense) {
+			sync_newFrame(stamp - frame_start);
+		}
+		frame_start = stamp;
+		frame_valid = !in_dense;
+		frame_age = 0;
+		frame_age_at = stamp;
+		state = STATE_WAIT_THRES;
+	}
+
+	/* The console is probably not polling if nothing is known. Revert
+	 * to default threshold instead of calculating an invalid one. */
+	if (locked) {
+		sync_setThreshold((period_q8 + 128) >> 8);
+	} else if (n_periods) {
+		sync_setThreshold(sync_medianPeriod());
+	} else {
+		poll_threshold = DEFAULT_THRESHOLD;
+	}
+
+	sync_alignToPacket();
+
+	sync_setCompare(frame_start + poll_threshold);
+}
+
+/* Returns non-zero if the data served to the console may change now, that
+ * is if no burst of latches is in progress. Interrupts must be disabled
+ * until the change is made, for a latch not to start a burst in between.
+ *
+ * The quiet gap is measured from the end of the last read, for a raw
+ * mode read lasts longer than BURST_GAP. While a read is in progress,
+ * sync_idle_since still holds its latch (see sync_latch_event()).
+ *
+ * Games such as Paperboy (pause screen) latch without end. Past
+ * BURST_MAX from the first latch of the burst, this is not a repeated
+ * read and does not hold the data back. */
+char sync_may_publish(void)
+{
+	unsigned int now = TCNT1; // interrupts are disabled
+
+	if (sync_idle_since != sync_last_latch &&
+			(unsigned int)(now - sync_idle_since) >= BURST_GAP)
+		return 1;
+
+	return (unsigned int)(now - sync_latches[sync_latch_head].stamp) >= BURST_MAX;
+}
+
+/* Call before polling the controller, with whether the poll starts with
+ * a GC_GETID. */
+void sync_poll_begin(char getid)
+{
+	unsigned char sreg = SREG;
+
+	poll_getid = getid;
+
+	cli();
+	poll_start = TCNT1;
+	poll_latch = sync_last_latch;
+	SREG = sreg;
+}
+
+/* Call once the data from the poll is ready for the NES, with the kind of
+ * controller now connected. After a failure, this is GC_KIND_UNKNOWN,
+ * which is also what the next poll will be (with a GC_GETID first). */
+void sync_poll_end(unsigned char kind)
+{
+	unsigned int cost = sync_now() - poll_start;
+	unsigned int *est;
+	unsigned int last_latch;
+	unsigned char sreg;
+
+	if (cost > (0xffff >> POLL_COST_SHIFT))
+		cost = 0xffff >> POLL_COST_SHIFT;
+	cost <<= POLL_COST_SHIFT;
+
+	if (kind >= SYNC_POLL_KINDS)
+		kind = 0;
+	poll_kind = kind;
+
+	poll_count++;
+
+	/* A latch interrupting the poll made it longer than it is. If the
+	 * poll was placed from the frame period, it was placed too late. */
+	sreg = SREG;
+	cli();
+	last_latch = sync_last_latch;
+	SREG = sreg;
+
+	if (poll_latch != last_latch) {
+		collision_count++;
+		if (poll_scheduled && locked) {
+			margin = margin < MARGIN_MAX / 2 ? margin * 2 : MARGIN_MAX;
+		}
+		poll_scheduled = 0;
+		return;
+	}
+
+	if (poll_scheduled && locked) {
+		margin -= 1 + (margin >> 6);
+		if (margin < MARGIN_MIN)
+			margin = MARGIN_MIN;
+	}
+	poll_scheduled = 0;
+
+	/* A GC_GETID makes the poll longer, but only comes at first, after
+	 * a failure and every GC_ID_KEEPALIVE polls. The scheduled polls do
+	 * not need room for it. */
+	if (poll_getid)
+		return;
+
+	est = &poll_cost[kind];
+	if (cost > *est) {
+		*est += (cost - *est) >> POLL_COST_RISE_SHIFT;
+	} else {
+		*est -= (*est - cost) >> POLL_COST_FALL_SHIFT;
+	}
+}
+
+/* Number of polls measured and how many of them were interrupted by a
+ * latch. */
+void sync_getCollisions(unsigned int *polls, unsigned int *collisions)
+{
+	*polls = poll_count;
+	*collisions = collision_count;
+}
+
+unsigned int sync_getMargin(void)
+{
+	return margin;
+}
+
+char sync_locked(void)
+{
+	return locked;
+}
+
+unsigned char sync_standard(void)
+{
+	unsigned long tol = PERIOD_TOLERANCE(period_q8) / 4;
+
+	if (!locked)
+		return SYNC_STD_UNKNOWN;
+	if (period_q8 + tol > NTSC_PERIOD && period_q8 < NTSC_PERIOD + tol)
+		return SYNC_STD_NTSC;
+	if (period_q8 + tol > PAL_PERIOD && period_q8 < PAL_PERIOD + tol)
+		return SYNC_STD_PAL;
+	return SYNC_STD_UNKNOWN;
+}
+
+/* When the game reads the controller without end, returns non-zero
+ * when a poll started now would fit in the idle time before the next
+ * latch.
+ *
+ * The idle times between reads usually follow a pattern: the read loop
+ * of the game does the same thing over and over. The shortest period
+ * over which the last gaps repeat is searched, and the gap following
+ * the current one is expected to be what it was one period ago. A poll
+ * is started right after the read preceding a large enough gap. */
+char sync_may_steal(void)
+{
+	unsigned int gaps[SYNC_GAP_RING];
+	unsigned int idle_since, last_latch, need, elapsed;
+	unsigned char head, p, i, a, b;
+	unsigned char sreg;
+
+	if (!sync_dense())
+		return 0;
+
+	sreg = SREG;
+	cli();
+	head = sync_gap_head;
+	idle_since = sync_idle_since;
+	last_latch = sync_last_latch;
+	for (i=0; i<SYNC_GAP_RING; i++) {
+		gaps[i] = sync_gaps[i];
+	}
+	SREG = sreg;
+
+	/* Only right after a read. */
+	elapsed = sync_now() - idle_since;
+	if (idle_since == last_latch || elapsed > STEAL_WINDOW)
+		return 0;
+
+	for (p=1; p<=GAP_MAX_PERIOD; p++) {
+		for (i=0; i<p; i++) {
+			a = (head - i) & (SYNC_GAP_RING - 1);
+			b = (head - i - p) & (SYNC_GAP_RING - 1);
+			if (gaps[a] + GAP_TOLERANCE(gaps[a]) < gaps[b] ||
+				gaps[b] + GAP_TOLERANCE(gaps[b]) < gaps[a])
+				break;
+		}
+		if (i == p)
+			break;
+	}
+	if (p > GAP_MAX_PERIOD)
+		return 0;
+
+	/* The expected gap, less what it may be shorter by. */
+	a = (head + 1 - p) & (SYNC_GAP_RING - 1);
+	need = (poll_cost[poll_kind] >> POLL_COST_SHIFT) + MARGIN_MIN + elapsed;
+
+	return gaps[a] >= need + GAP_TOLERANCE(gaps[a]);
+}
+
+/* Called when a poll was interrupted (by a latch, most of the time).
+ * Returns non-zero if restarting it now should still be over before the
+ * next latch. */
+char sync_may_retry(void)
+{
+	unsigned char sreg = SREG;
+	unsigned int last_frame, age, need, period;
+
+	if (sync_dense())
+		return 0;
+
+	/* Polling continuously anyway. */
+	if (!locked)
+		return 1;
+
+	/* The interrupting latch may not have been seen by
+	 * sync_master_polled_us() yet. */
+	cli();
+	last_frame = sync_latches[sync_latch_head].stamp;
+	SREG = sreg;
+
+	age = sync_now() - last_frame;
+	need = (poll_cost[poll_kind] >> POLL_COST_SHIFT) + margin;
+	period = (period_q8 + 128) >> 8;
+
+	return age < period && period - age >= need;
+}
+
+/* Returns non-zero when an extra poll fits before the scheduled one.
+ * Polls already run continuously until the period is locked. */
+char sync_may_sample(void)
+{
+	unsigned int now = sync_now();
+	unsigned int age = now - frame_start;
+	unsigned int need;
+	unsigned char sreg;
+	char in_burst;
+
+	if (!locked || state != STATE_WAIT_THRES || sync_dense())
+		return 0;
+
+	if ((unsigned int)(now - poll_start) < SAMPLE_INTERVAL)
+		return 0;
+
+	/* Not in the middle of a burst of latches */
+	sreg = SREG;
+	cli();
+	in_burst = !sync_may_publish();
+	SREG = sreg;
+	if (in_burst)
+		return 0;
+
+	need = (poll_cost[poll_kind] >> POLL_COST_SHIFT) + SPIN_TICKS;
+
+	return age < poll_threshold && poll_threshold - age > need;
+}
+
+/* Changes when a frame starts. */
+unsigned char sync_frame(void)
+{
+	return sync_latch_head;
 }
 
 char sync_may_poll(void)
 {
+	unsigned int now = sync_now();
+	unsigned int age = now - frame_start;
+	unsigned char sreg;
+
+	/* Called by each pass of the main loop, much more often than the
+	 * timer wraps. */
+	frame_age += (unsigned int)(now - frame_age_at);
+	frame_age_at = now;
+
+	if (frame_valid && frame_age >= STALE_AGE) {
+		frame_valid = 0;
+
+		/* The game stopped reading (loading, reset...). The period
+		 * will have to be confirmed again when it resumes. */
+		locked = 0;
+		agree_count = 0;
+		n_periods = 0;
+
+		/* Make sure the next latch starts a frame even if the
+		 * timer wrapped close to the last one. */
+		sreg = SREG;
+		cli();
+		if (latch_tail == sync_latch_head)
+			sync_latches[sync_latch_head].count = 0;
+		SREG = sreg;
+	}
+
+	if (sync_dense())
+		return 0;
+
+#ifndef OLD_MODE
+	/* Until the frame period is known, there is no last moment to wait
+	 * for. Poll continuously so the console always gets the newest
+	 * sample. */
+	if (!locked) {
+		state = STATE_THRESHOLD_REACHED;
+		poll_scheduled = 0;
+		return 1;
+	}
+#endif
+
 	if (state == STATE_WAIT_THRES)
 	{
-		if (TCNT1 >= poll_threshold) {
+		if (age < poll_threshold && poll_threshold - age <= SPIN_TICKS) {
+			while (!(TIFR & (1<<OCF1A))) {
+				// wait for the compare match
+			}
+			age = poll_threshold;
+		}
+
+		if (age >= poll_threshold) {
 			state = STATE_THRESHOLD_REACHED;
+			poll_scheduled = 1;
 			return 1;
 		}
 	}
 
-		
 	return 0;
 }
-
-
@@ -1,9 +1,115 @@
 #ifndef _sync_h__
 #define _sync_h__
 
+#include "boarddef.h"
+
+/* Timer1 is the time base of sync.c. With GC_RX_ICP, the receive code
+ * also uses it to timestamp edges, which requires a finer resolution.
+ * It then overflows every 43ms at 12MHz (262ms at /64). */
+#ifdef GC_RX_ICP
+#define SYNC_TIMER_DIV		8
+#define SYNC_TIMER_CS		(1<<CS11)
+#else
+#define SYNC_TIMER_DIV		64
+#define SYNC_TIMER_CS		((1<<CS11) | (1<<CS10))
+#endif
+
+#define US_TO_TICKS(us)		((us) * (F_CPU / 1000000L) / SYNC_TIMER_DIV)
+
+/* The constants of sync.c were tuned for the /64 prescaler. This converts
+ * them to the prescaler in use. */
+#define T64(ticks)			((ticks) * (64 / SYNC_TIMER_DIV))
+
+/* Latches closer than this to the first latch of a frame belong to
+ * that frame. */
+#define MIN_IDLE			T64(1700) // 5ms
+
+/* Latch events, written by the NES interrupt handler. Timer1 runs
+ * freely so the timestamps are exact no matter how late the main
+ * loop looks at them. One entry per frame: the time of its first
+ * latch and how many latches followed. A zero count means the next
+ * latch starts a new frame.
+ *
+ * The count is of latches at the start and end of a read, not of every
+ * latch: the bit-banged INT0 handler serves a whole read and records
+ * the latch which started it, then the last of the latches seen during
+ * the read, if any (see int0_done in main.c). A read counts once, or
+ * twice however many times it was relatched. The SPI build records every latch. The frame period only
+ * uses the stamps, never the count. */
+#define SYNC_LATCH_RING		4
+
+struct sync_latch {
+	unsigned int stamp;
+	unsigned char count;
+};
+
+extern volatile struct sync_latch sync_latches[SYNC_LATCH_RING];
+extern volatile unsigned char sync_latch_head;
+extern volatile unsigned int sync_last_latch;
+
+/* Idle time before each of the last latches: from the end of the
+ * previous read (or the previous latch, if it was buried in a read) to
+ * the latch. Used to find room for a poll when a game latches without
+ * end. */
+#define SYNC_GAP_RING		16
+
+extern volatile unsigned int sync_gaps[SYNC_GAP_RING];
+extern volatile unsigned char sync_gap_head;
+extern volatile unsigned int sync_idle_since;
+
+/* Call from the latch interrupt with the value of TCNT1. */
+static inline void sync_latch_event(unsigned int stamp)
+{
+	volatile struct sync_latch *l = &sync_latches[sync_latch_head];
+
+	sync_last_latch = stamp;
+
+	sync_gap_head = (sync_gap_head + 1) & (SYNC_GAP_RING - 1);
+	sync_gaps[sync_gap_head] = stamp - sync_idle_since;
+	sync_idle_since = stamp;
+
+	if (l->count && (unsigned int)(stamp - l->stamp) < MIN_IDLE) {
+		if (l->count != 0xff)
+			l->count++;
+		return;
+	}
+
+	sync_latch_head = (sync_latch_head + 1) & (SYNC_LATCH_RING - 1);
+	l = &sync_latches[sync_latch_head];
+	l->stamp = stamp;
+	l->count = 1;
+}
+
+/* Call from the latch interrupt when the read is over. */
+static inline void sync_latch_done(unsigned int stamp)
+{
+	sync_idle_since = stamp;
+}
+
+/* Number of controller kinds for which the poll duration is measured
+ * (see GC_KINDS). */
+#define SYNC_POLL_KINDS		3
+
+/* Frame rate the estimator is locked on. PAL also covers Dendy clones. */
+#define SYNC_STD_UNKNOWN	0
+#define SYNC_STD_NTSC		1
+#define SYNC_STD_PAL		2
+
 void sync_init(void);
 void sync_master_polled_us(void);
 char sync_may_poll(void);
+char sync_may_steal(void);
+char sync_may_retry(void);
+char sync_may_sample(void);
+unsigned char sync_frame(void);
+void sync_packet_poll(char changed);
+unsigned int sync_getStaleness(void);
+char sync_may_publish(void);
+void sync_poll_begin(char getid);
+void sync_poll_end(unsigned char kind);
+void sync_getCollisions(unsigned int *polls, unsigned int *collisions);
+unsigned int sync_getMargin(void);
+char sync_locked(void);
+unsigned char sync_standard(void);
 
 #endif // _sync_h__
-